@@ -3,18 +3,39 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <functional>
 #include <cstring>
 #include <chrono>
 #include <algorithm>
+#include <numeric>
+#include <tuple>
 #include <sstream>
 #include <iomanip>
 #include <sys/stat.h>
 #include <thread>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <fnmatch.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <sys/uio.h>
+#include <climits>
+#include <deque>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // ==========================================
 // part 1: the actual db engine
@@ -31,511 +52,3391 @@ namespace CFG{
 	const std::string J_FILE="journal.log";
 }
 
+// runtime knobs, defaults are the CFG ones
+struct Opts{
+	size_t cacheB=CFG::C_SZ*CFG::P_SZ; // buffer pool size in bytes
+	size_t pgSz=CFG::P_SZ;   // only used when database.dat is created
+	std::string dFile=CFG::D_FILE;
+	std::string iFile=CFG::I_FILE;
+	std::string jFile=CFG::J_FILE;
+	bool fsync=true;         // false = commit just hands the log to the os
+	bool huge=false;         // back the buffer pool with huge pages
+	unsigned flushMs=20;     // how often the background flusher wakes up
+	unsigned vacS=60;        // seconds between vacuum passes, 0 = off
+	size_t vacRate=2000;     // pages a second the vacuum may move
+	unsigned vacPct=25;      // pages less full than this get emptied
+	size_t ckptB=64<<20;     // journal size that makes the flusher checkpoint
+};
+
 // core stuff
 struct Rec{
-	char key[CFG::K_SZ];
-	char val[CFG::V_SZ];
+	std::string key;
+	std::string val;
 	uint64_t pid;
+	uint16_t slot;
 	bool del;
 	
-	Rec():pid(0),del(false){
-		memset(key,0,CFG::K_SZ);
-		memset(val,0,CFG::V_SZ);
-	}
+	Rec():pid(0),slot(0),del(false){}
 	
 	Rec(const std::string& k,const std::string& v,uint64_t p=0)
-		:pid(p),del(false){
-		strncpy(key,k.c_str(),CFG::K_SZ-1);
-		strncpy(val,v.c_str(),CFG::V_SZ-1);
-	}
+		:key(k.substr(0,CFG::K_SZ-1)),val(v.substr(0,CFG::V_SZ-1)),
+		 pid(p),slot(0),del(false){}
 	
-	std::string getK() const{return std::string(key);}
-	std::string getV() const{return std::string(val);}
+	std::string getK() const{return key;}
+	std::string getV() const{return val;}
 };
 
+// record id = (page id, slot) packed in one word, so the index can keep it
+inline uint64_t mkRid(uint64_t pid,uint16_t slot){return (pid<<16)|slot;}
+inline uint64_t ridPg(uint64_t rid){return rid>>16;}
+inline uint16_t ridSl(uint64_t rid){return rid&0xFFFF;}
+
+// byte helpers for the on-disk formats
+inline void put16(std::string& b,uint16_t v){b.append((const char*)&v,2);}
+inline void put32(std::string& b,uint32_t v){b.append((const char*)&v,4);}
+inline void put64(std::string& b,uint64_t v){b.append((const char*)&v,8);}
+inline uint16_t get16(const char* p){uint16_t v;memcpy(&v,p,2);return v;}
+inline uint32_t get32(const char* p){uint32_t v;memcpy(&v,p,4);return v;}
+inline uint64_t get64(const char* p){uint64_t v;memcpy(&v,p,8);return v;}
+
+// crc32c (castagnoli), plain table version
+inline uint32_t crc32c(const char* p,size_t n){
+	static const auto tbl=[]{
+		std::vector<uint32_t> t(256);
+		for(uint32_t i=0;i<256;++i){
+			uint32_t c=i;
+			for(int k=0;k<8;++k)c=(c&1)?(c>>1)^0x82F63B78u:(c>>1);
+			t[i]=c;
+		}
+		return t;
+	}();
+	uint32_t c=0xFFFFFFFFu;
+	for(size_t i=0;i<n;++i){
+		c=tbl[(c^(uint8_t)p[i])&0xFF]^(c>>8);
+	}
+	return c^0xFFFFFFFFu;
+}
+
+// slotted page:
+// [hdr][slot dir ->]      free      [<- cells]
+// hdr  = nSlot(2) fPtr(2) dead(2) lsn(8)
+// slot = off(2) len(2), off==0 means the slot is free
+// cell = klen(2) vlen(2) key val
 struct Pg{
+	static constexpr size_t HDR=14;
+	static constexpr size_t SLOT=4;
+	static constexpr size_t CHDR=4;
+	// an empty page has to take the biggest record fits() lets through
+	static constexpr size_t MIN_SZ=2048;
+	static_assert(HDR+SLOT+CHDR+CFG::K_SZ+CFG::V_SZ<=MIN_SZ,"MIN_SZ too small for a record");
+	
 	uint64_t pid;
-	char data[CFG::P_SZ];
-	bool drty;
+	size_t sz;
+	std::unique_ptr<char[]> mem;
+	char* data;
+	std::atomic<bool> drty; // the flusher peeks without the page latch
+	std::atomic<uint64_t> chg; // bumped on every change, never on disk
+	std::atomic<uint64_t> recLsn; // while drty: oldest change not on disk is >= this
+	bool bad;     // failed sane() when it was read in, nothing gets written to it
+	
+	// offsets are 16 bit, so pages top out at 32k
+	static bool okSz(size_t n){
+		return n>=MIN_SZ&&n<=32768&&(n&(n-1))==0;
+	}
+	
+	Pg(uint64_t id=0,size_t pgSz=CFG::P_SZ)
+		:pid(id),sz(pgSz),mem(new char[pgSz]),data(mem.get()),drty(false),chg(0),recLsn(0),bad(false){
+		memset(data,0,sz);
+		init();
+	}
+	
+	// view over memory someone else owns (buffer pool frames)
+	Pg(uint64_t id,char* buf,size_t pgSz)
+		:pid(id),sz(pgSz),data(buf),drty(false),chg(0),recLsn(0),bad(false){}
 	
-	Pg(uint64_t id=0):pid(id),drty(false){
-		memset(data,0,CFG::P_SZ);
+	Pg(Pg&& o)
+		:pid(o.pid),sz(o.sz),mem(std::move(o.mem)),data(o.data),
+		 drty(o.drty.load()),chg(o.chg.load()),recLsn(o.recLsn.load()),bad(o.bad){}
+	
+	uint16_t rd16(size_t off) const{
+		uint16_t v;
+		memcpy(&v,data+off,2);
+		return v;
+	}
+	
+	void wr16(size_t off,uint16_t v){
+		memcpy(data+off,&v,2);
+	}
+	
+	uint16_t nSlot() const{return rd16(0);}
+	uint16_t fPtr() const{return rd16(2);}
+	uint16_t dead() const{return rd16(4);}
+	uint64_t lsn() const{return get64(data+6);}
+	
+	// last journal entry that touched this page
+	void setLsn(uint64_t l){
+		touch();
+		memcpy(data+6,&l,8);
 	}
 	
-	void wRec(const Rec& rec){
-		memcpy(data,&rec,sizeof(Rec));
+	// lsns only go up on a page, so whatever changes it now is newer
+	// than the lsn it has
+	void touch(){
+		if(!drty)recLsn=lsn()+1;
 		drty=true;
+		chg++;
 	}
+	uint16_t sOff(uint16_t s) const{return rd16(HDR+s*SLOT);}
+	uint16_t sLen(uint16_t s) const{return rd16(HDR+s*SLOT+2);}
 	
-	Rec rRec() const{
-	Rec rec;
-		memcpy(&rec,data,sizeof(Rec));
-		return rec;
+	void setSlot(uint16_t s,uint16_t off,uint16_t len){
+		wr16(HDR+s*SLOT,off);
+		wr16(HDR+s*SLOT+2,len);
 	}
-};
-
-// the log (WAL)
-class JMan{
-private:
-	std::fstream jFile;
 	
-	enum Op{INS,UPD,DEL,CMT};
+	// zeroed pages (fresh or past eof) get an empty header
+	void init(){
+		if(fPtr()==0){
+			wr16(0,0);
+			wr16(2,sz);
+			wr16(4,0);
+			setLsn(0);
+		}
+	}
 	
-	struct JEnt{
-		Op op;
-		char key[CFG::K_SZ];
-		char val[CFG::V_SZ];
-		uint64_t pid;
-		
-		JEnt():op(INS),pid(0){
-			memset(key,0,CFG::K_SZ);
-			memset(val,0,CFG::V_SZ);
+	// contiguous gap between the slot dir and the cells
+	size_t gap() const{
+		return fPtr()-(HDR+nSlot()*SLOT);
+	}
+	
+	// what we'd have after compacting
+	size_t freeSp() const{
+		return gap()+dead();
+	}
+	
+	static size_t cellSz(const std::string& k,const std::string& v){
+		return CHDR+k.size()+v.size();
+	}
+	
+	// slot s holds a record that stays inside the page. the page can come
+	// from a torn write, so nothing read off it is trusted: a slot that
+	// points outside the cells or a cell whose lengths don't add up counts
+	// as empty
+	bool live(uint16_t s) const{
+		size_t dir=HDR+nSlot()*SLOT;
+		if(s>=nSlot()||dir>sz)return false;
+		size_t off=sOff(s),len=sLen(s);
+		if(off==0)return false;
+		if(off<dir||off+len>sz||len<CHDR)return false;
+		return CHDR+rd16(off)+rd16(off+2)<=len;
+	}
+	
+	// header and every used slot check out, so the page is safe to change
+	bool sane() const{
+		size_t dir=HDR+nSlot()*SLOT;
+		if(dir>fPtr()||fPtr()>sz||dead()>sz)return false;
+		for(uint16_t s=0;s<nSlot();++s){
+			if(sOff(s)!=0&&!live(s))return false;
 		}
-	};
+		return true;
+	}
 	
-public:
-	JMan(){
-		jFile.open(CFG::J_FILE,
-			std::ios::in|std::ios::out|std::ios::binary|std::ios::app);
-		if(!jFile.is_open()){
-			jFile.open(CFG::J_FILE,
-				std::ios::out|std::ios::binary);
-			jFile.close();
-			jFile.open(CFG::J_FILE,
-				std::ios::in|std::ios::out|std::ios::binary);
+	// first free slot, or nSlot() if we need a new one
+	uint16_t freeSlot() const{
+		for(uint16_t s=0;s<nSlot();++s){
+			if(sOff(s)==0)return s;
 		}
+		return nSlot();
 	}
 	
-	~JMan(){
-		if(jFile.is_open()){
-			jFile.close();
+	bool fits(size_t sz) const{
+		size_t need=sz+(freeSlot()==nSlot()?SLOT:0);
+		return freeSp()>=need;
+	}
+	
+	// squeeze dead cells out, slot numbers stay put
+	void compact(){
+		std::vector<char> tmp(sz);
+		size_t ptr=sz;
+		for(uint16_t s=0;s<nSlot();++s){
+			if(sOff(s)==0)continue;
+			uint16_t len=sLen(s);
+			ptr-=len;
+			memcpy(&tmp[ptr],data+sOff(s),len);
+			setSlot(s,ptr,len);
 		}
+		memcpy(data+ptr,&tmp[ptr],sz-ptr);
+		wr16(2,ptr);
+		wr16(4,0);
 	}
 	
-	void logOp(const std::string& opType,const std::string& key,
-						 const std::string& val="",uint64_t pid=0){
-		JEnt ent;
-		
-		if(opType=="INSERT")ent.op=INS;
-		else if(opType=="UPDATE")ent.op=UPD;
-		else if(opType=="DELETE")ent.op=DEL;
-		else if(opType=="COMMIT")ent.op=CMT;
+	// carve out sz bytes for slot s, returns offset
+	uint16_t carve(uint16_t s,size_t sz){
+		size_t need=sz+(s==nSlot()?SLOT:0);
+		if(gap()<need)compact();
+		if(s==nSlot()){
+			wr16(0,nSlot()+1);
+		}
+		uint16_t off=fPtr()-sz;
+		wr16(2,off);
+		setSlot(s,off,sz);
+		return off;
+	}
+	
+	void wCell(uint16_t off,const std::string& k,const std::string& v){
+		wr16(off,k.size());
+		wr16(off+2,v.size());
+		memcpy(data+off+CHDR,k.data(),k.size());
+		memcpy(data+off+CHDR+k.size(),v.data(),v.size());
+	}
+	
+	// -1 if it doesn't fit
+	int ins(const std::string& k,const std::string& v){
+		size_t sz=cellSz(k,v);
+		if(!fits(sz))return -1;
 		
-		strncpy(ent.key,key.c_str(),CFG::K_SZ-1);
-		strncpy(ent.val,val.c_str(),CFG::V_SZ-1);
-		ent.pid=pid;
+		uint16_t s=freeSlot();
+		uint16_t off=carve(s,sz);
+		wCell(off,k,v);
+		touch();
+		return s;
+	}
+	
+	bool rd(uint16_t s,Rec& rec) const{
+		if(!live(s))return false;
+		uint16_t off=sOff(s);
+		uint16_t kl=rd16(off),vl=rd16(off+2);
+		rec.key.assign(data+off+CHDR,kl);
+		rec.val.assign(data+off+CHDR+kl,vl);
+		rec.pid=pid;
+		rec.slot=s;
+		rec.del=false;
+		return true;
+	}
+	
+	// append slot s's value to out if the slot holds key, no Rec copy
+	bool valTo(uint16_t s,const std::string& key,std::string& out) const{
+		if(!live(s))return false;
+		uint16_t off=sOff(s);
+		uint16_t kl=rd16(off),vl=rd16(off+2);
+		if(kl!=key.size()||memcmp(data+off+CHDR,key.data(),kl)!=0)return false;
+		out.append(data+off+CHDR+kl,vl);
+		return true;
+	}
+	
+	// false if the new value doesn't fit here, caller has to move it
+	bool upd(uint16_t s,const std::string& v){
+		Rec rec;
+		if(!rd(s,rec))return false;
 		
-		jFile.seekp(0,std::ios::end);
-		jFile.write(reinterpret_cast<char*>(&ent),sizeof(JEnt));
-		jFile.flush(); // better safe than sorry
+		size_t oldSz=sLen(s);
+		size_t sz=cellSz(rec.key,v);
+		if(sz<=oldSz){
+			// shrink in place
+			uint16_t off=sOff(s);
+			wCell(off,rec.key,v);
+			setSlot(s,off,sz);
+			wr16(4,dead()+(oldSz-sz));
+		}else{
+			if(freeSp()+oldSz<sz)return false;
+			setSlot(s,0,0);
+			wr16(4,dead()+oldSz);
+			uint16_t off=carve(s,sz);
+			wCell(off,rec.key,v);
+		}
+		touch();
+		return true;
 	}
 	
-	void commit(){
-		logOp("COMMIT","");
+	void del(uint16_t s){
+		if(!live(s))return;
+		wr16(4,dead()+sLen(s));
+		setSlot(s,0,0);
+		// free slots at the end come off the dir, an empty page has none
+		uint16_t n=nSlot();
+		while(n>0&&sOff(n-1)==0)n--;
+		wr16(0,n);
+		touch();
 	}
 	
-	void trunc(){
-		jFile.close();
-		std::remove(CFG::J_FILE.c_str());
-		jFile.open(CFG::J_FILE,
-			std::ios::in|std::ios::out|std::ios::binary|std::ios::trunc);
+	// back to an empty page (lsn stays) for the free list
+	void wipe(){
+		wr16(0,0);
+		wr16(2,sz);
+		wr16(4,0);
+		touch();
+	}
+	
+	std::vector<Rec> recs() const{
+		std::vector<Rec> res;
+		for(uint16_t s=0;s<nSlot();++s){
+			Rec rec;
+			if(rd(s,rec))res.push_back(rec);
+		}
+		return res;
 	}
 };
 
-// the cache
-class BPool{
-private:
-	struct CEnt{
-		std::shared_ptr<Pg> pg;
-		size_t tm;
+// the log (WAL)
+// writers queue their entries, whoever shows up first while nobody is
+// writing takes the whole queue out in one write + one fdatasync
+// (group commit), everybody else just waits for their lsn
+//
+// file = magic(8) baseLsn(8), then records:
+// len(4) lsn(8) op(1) klen(2) vlen(4) key val crc(4)
+// len covers lsn..val, crc covers len..val
+// checkpoints cut the front off: what's left gets copied to a new file
+// that's renamed over the old one
+class JMan{
+public:
+	enum Op{INS,UPD,DEL,CMT};
+	
+	struct JOp{
+		Op op;
+		std::string key;
+		std::string val;
 	};
 	
-	std::map<uint64_t,CEnt> cache;
-	size_t curTm;
+private:
+	static constexpr uint64_t MAGIC=0x314C414E524A4442ULL;
+	static constexpr size_t FHDR=16;
+	static constexpr size_t RHDR=8+1+2+4;
+	static constexpr size_t RMAX=RHDR+CFG::K_SZ+CFG::V_SZ; // longest len there is
 	
-public:
-	BPool():curTm(0){}
+	std::string fn;
+	int fd;
+	bool fsync;
 	
-	std::shared_ptr<Pg> get(uint64_t pid){
-		auto it=cache.find(pid);
-		if(it!=cache.end()){
-			it->second.tm=++curTm;
-			return it->second.pg;
-		}
-		return nullptr;
-	}
+	std::mutex mu;
+	std::condition_variable cv;
+	std::string pend;   // queued, not written yet
+	uint64_t lsn;       // last lsn handed out
+	uint64_t durLsn;    // everything up to here is on disk
+	bool busy;          // a leader is writing right now
+	off_t fEnd;         // file size
+	// (last lsn, file offset after it) for every write. a write is whole
+	// transactions, so these are the places the log can be cut at
+	std::deque<std::pair<uint64_t,off_t>> marks;
 	
-	void put(uint64_t pid,std::shared_ptr<Pg> pg){
-		if(cache.size()>=CFG::C_SZ){
-			evict();
-		}
-		cache[pid]={pg,++curTm};
+	void enq(Op op,const std::string& key,const std::string& val){
+		std::string k=key.substr(0,CFG::K_SZ-1);
+		std::string v=val.substr(0,CFG::V_SZ-1);
+		
+		size_t at=pend.size();
+		put32(pend,RHDR+k.size()+v.size());
+		put64(pend,++lsn);
+		pend.push_back((char)op);
+		put16(pend,k.size());
+		put32(pend,v.size());
+		pend+=k;
+		pend+=v;
+		put32(pend,crc32c(&pend[at],pend.size()-at));
 	}
 	
-	void evict(){
-		auto old=cache.begin();
-		for(auto it=cache.begin();it!=cache.end();++it){
-			if(it->second.tm<old->second.tm){
-				old=it;
+	// a commit can't be acked once its bytes may not have made it, and a
+	// later write can't go in behind a hole, so a failed write or sync
+	// stops the process (same as a failed data file write)
+	void wAll(const std::string& b){
+		size_t off=0;
+		while(off<b.size()){
+			ssize_t n=::write(fd,b.data()+off,b.size()-off);
+			if(n<0){
+				if(errno==EINTR)continue;
+				perror("Journal write failed");
+				exit(EXIT_FAILURE);
 			}
-		}
-		if(old!=cache.end()){
-			cache.erase(old);
+			off+=n;
 		}
 	}
 	
-	std::vector<std::shared_ptr<Pg>> getDirty(){
-		std::vector<std::shared_ptr<Pg>> dirty;
-		for(auto& pair:cache){
-			if(pair.second.pg->drty){
-				dirty.push_back(pair.second.pg);
-			}
+	void dSync(){
+		if(fdatasync(fd)!=0){
+			perror("Journal sync failed");
+			exit(EXIT_FAILURE);
 		}
-		return dirty;
 	}
 	
-	void clear(){
-		cache.clear();
+	// fresh file that starts counting at base
+	void wHdr(uint64_t base){
+		std::string h;
+		put64(h,MAGIC);
+		put64(h,base);
+		wAll(h);
+		dSync();
+		fEnd=FHDR;
+		marks.clear();
 	}
-};
-
-// magic b-tree stuff
-struct BNode{
-	bool leaf;
-	std::vector<std::string> keys;
-	std::vector<uint64_t> vals;
-	std::vector<std::shared_ptr<BNode>> kids;
-	std::shared_ptr<BNode> next;
 	
-	BNode(bool l=true):leaf(l),next(nullptr){}
+	void opn(const std::string& f){
+		fd=::open(f.c_str(),O_RDWR|O_CREAT|O_APPEND,0644);
+		if(fd<0){
+			perror("Journal open failed");
+			exit(EXIT_FAILURE);
+		}
+	}
 	
-	size_t findPos(const std::string& key) const{
-		return std::lower_bound(keys.begin(),keys.end(),key)-keys.begin();
+	// n bytes from off on, short only at the end of the file
+	std::string rdAt(off_t off,size_t n){
+		std::string b(n,'\0');
+		size_t got=0;
+		while(got<n){
+			ssize_t r=::pread(fd,&b[got],n-got,off+got);
+			if(r<0&&errno==EINTR)continue;
+			if(r<=0)break;
+			got+=r;
+		}
+		b.resize(got);
+		return b;
 	}
-};
-
-class BTree{
-private:
-	std::shared_ptr<BNode> root;
-	size_t ord;
 	
-	std::shared_ptr<BNode> split(std::shared_ptr<BNode> node){
-		auto newNode=std::make_shared<BNode>(node->leaf);
-		size_t mid=node->keys.size()/2;
+public:
+	JMan(const std::string& f=CFG::J_FILE,bool doSync=true)
+		:fn(f),fsync(doSync),lsn(0),durLsn(0),busy(false),fEnd(FHDR){
+		opn(fn);
 		
-		if(node->leaf){
-			newNode->keys.assign(node->keys.begin()+mid,node->keys.end());
-			newNode->vals.assign(node->vals.begin()+mid,node->vals.end());
-			newNode->next=node->next;
-			node->next=newNode;
-			
-			node->keys.resize(mid);
-			node->vals.resize(mid);
+		char h[FHDR];
+		if(::pread(fd,h,FHDR,0)==(ssize_t)FHDR&&get64(h)==MAGIC){
+			lsn=durLsn=get64(h+8)-1;
+			fEnd=lseek(fd,0,SEEK_END);
 		}else{
-			newNode->keys.assign(node->keys.begin()+mid+1,node->keys.end());
-			newNode->kids.assign(node->kids.begin()+mid+1,
-									   node->kids.end());
-			
-			node->keys.resize(mid);
-			node->kids.resize(mid+1);
+			if(ftruncate(fd,0)<0)perror("Journal truncate failed");
+			wHdr(1);
 		}
-		
-		return newNode;
 	}
 	
-	std::pair<std::shared_ptr<BNode>,std::string>
-	insInt(std::shared_ptr<BNode> node,const std::string& key,
-				 uint64_t val){
-		if(node->leaf){
-			size_t pos=node->findPos(key);
-			
-			if(pos<node->keys.size()&&node->keys[pos]==key){
-				node->vals[pos]=val; // update
-				return std::make_pair(nullptr,"");
+	~JMan(){
+		if(fd>=0){
+			::close(fd);
+		}
+	}
+	
+	// queue a whole transaction (ops + COMMIT) back to back so other
+	// writers can't land in the middle of it, returns the commit lsn
+	uint64_t logTx(const std::vector<JOp>& ops){
+		std::lock_guard<std::mutex> lk(mu);
+		for(const auto& o:ops){
+			enq(o.op,o.key,o.val);
+		}
+		enq(CMT,"","");
+		return lsn;
+	}
+	
+	// block until upTo is durable
+	void sync(uint64_t upTo){
+		std::unique_lock<std::mutex> lk(mu);
+		while(durLsn<upTo){
+			if(busy){
+				cv.wait(lk);
+				continue;
 			}
 			
-			node->keys.insert(node->keys.begin()+pos,key);
-			node->vals.insert(node->vals.begin()+pos,val);
-			
-			if(node->keys.size()>=ord){
-				auto newNode=split(node);
-				return std::make_pair(newNode,newNode->keys[0]);
-			}
-			return std::make_pair(nullptr,"");
-		}else{
-			size_t pos=node->findPos(key);
-			if(pos==node->keys.size())pos=node->keys.size()-1;
-			else if(pos>0&&key<node->keys[pos])pos--;
+			// we're the leader, take everything queued so far
+			busy=true;
+			std::string batch;
+			batch.swap(pend);
+			uint64_t end=lsn;
+			lk.unlock();
 			
-			auto res=insInt(node->kids[pos],key,val);
-			auto newKid=res.first;
-			auto promKey=res.second;
+			wAll(batch);
+			if(fsync)dSync();
 			
-			if(newKid){
-				node->keys.insert(node->keys.begin()+pos+1,promKey);
-				node->kids.insert(node->kids.begin()+pos+1,newKid);
-				
-				if(node->keys.size()>=ord){
-					auto newNode=split(node);
-					std::string midKey=node->keys.back();
-					node->keys.pop_back();
-					return std::make_pair(newNode,midKey);
-				}
-			}
-			return std::make_pair(nullptr,"");
+			lk.lock();
+			durLsn=end;
+			fEnd+=batch.size();
+			if(!batch.empty())marks.emplace_back(end,fEnd);
+			busy=false;
+			cv.notify_all();
 		}
 	}
 	
-public:
-	BTree(size_t treeOrd=CFG::B_ORD)
-		:root(std::make_shared<BNode>(true)),ord(treeOrd){}
+	// last lsn handed out
+	uint64_t last(){
+		std::lock_guard<std::mutex> lk(mu);
+		return lsn;
+	}
 	
-	void insert(const std::string& key,uint64_t pid){
-		auto res=insInt(root,key,pid);
-		auto newNode=res.first;
-		auto promKey=res.second;
-		
-		if(newNode){
-			// root split
-			auto newRoot=std::make_shared<BNode>(false);
-			newRoot->keys.push_back(promKey);
-			newRoot->kids.push_back(root);
-			newRoot->kids.push_back(newNode);
-			root=newRoot;
-		}
+	uint64_t commit(const std::vector<JOp>& ops){
+		uint64_t l=logTx(ops);
+		sync(l);
+		return l;
 	}
 	
-	uint64_t search(const std::string& key) const{
-		auto node=root;
+	// pages on disk can be ahead of us if the log got lost, never hand
+	// out an lsn that's already been used
+	void bump(uint64_t l){
+		std::lock_guard<std::mutex> lk(mu);
+		if(l>lsn)lsn=durLsn=l;
+	}
+	
+	// bytes in the file
+	size_t size(){
+		std::lock_guard<std::mutex> lk(mu);
+		return fEnd;
+	}
+	
+	// walk the log and hand committed entries to fn(lsn,op,key,val),
+	// in order. stops at the first short or corrupt record (torn tail),
+	// whatever comes after the last COMMIT never happened. reads it a
+	// chunk at a time, only the open transaction is kept around
+	template<typename F>
+	size_t redo(F fn){
+		std::string b;
+		size_t off=0;
+		off_t at=FHDR;
+		// at least n bytes from off on in b, false at the end of the file
+		auto fill=[&](size_t n){
+			while(b.size()-off<n){
+				b.erase(0,off);
+				off=0;
+				std::string c=rdAt(at,1<<16);
+				if(c.empty())return false;
+				at+=c.size();
+				b+=c;
+			}
+			return true;
+		};
 		
-		while(!node->leaf){
-			size_t pos=node->findPos(key);
-			if(pos==node->keys.size())pos=node->keys.size()-1;
-			else if(pos>0&&key<node->keys[pos])pos--;
-			node=node->kids[pos];
-		}
+		struct Ent{
+			uint64_t lsn;
+			Op op;
+			std::string key;
+			std::string val;
+		};
+		std::vector<Ent> grp;
+		size_t n=0;
 		
-		size_t pos=node->findPos(key);
-		if(pos<node->keys.size()&&node->keys[pos]==key){
-			return node->vals[pos];
+		while(fill(4)){
+			size_t len=get32(&b[off]);
+			if(len<RHDR||len>RMAX||!fill(4+len+4))break;
+			const char* r=&b[off+4];
+			if(crc32c(&b[off],4+len)!=get32(r+len))break;
+			
+			size_t kl=get16(r+9);
+			size_t vl=get32(r+11);
+			if(RHDR+kl+vl!=len)break;
+			
+			Ent e{get64(r),(Op)r[8],std::string(r+RHDR,kl),
+				  std::string(r+RHDR+kl,vl)};
+			if(e.lsn>lsn)lsn=durLsn=e.lsn;
+			off+=4+len+4;
+			
+			if(e.op!=CMT){
+				grp.push_back(std::move(e));
+				continue;
+			}
+			for(const auto& g:grp){
+				fn(g.lsn,g.op,g.key,g.val);
+				++n;
+			}
+			grp.clear();
 		}
-		return 0; // not found
+		return n;
 	}
 	
-	void remove(const std::string& key){
-		// simple tombstone
-		auto node=root;
-		
-		while(!node->leaf){
-			size_t pos=node->findPos(key);
-			if(pos==node->keys.size())pos=node->keys.size()-1;
-			else if(pos>0&&key<node->keys[pos])pos--;
-			node=node->kids[pos];
-		}
-		
-		size_t pos=node->findPos(key);
-		if(pos<node->keys.size()&&node->keys[pos]==key){
-			node->vals[pos]=0;
+	void trunc(){
+		std::unique_lock<std::mutex> lk(mu);
+		while(busy)cv.wait(lk); // let a leader's write land first
+		pend.clear();
+		durLsn=lsn;
+		if(ftruncate(fd,0)<0){
+			perror("Journal truncate failed");
+			exit(EXIT_FAILURE);
 		}
+		wHdr(lsn+1);
 	}
 	
-	std::vector<std::string> getAllKeys() const{
-		std::vector<std::string> res;
-		auto node=root;
-		
-		while(!node->leaf&&!node->kids.empty()){
-			node=node->kids[0];
+	// everything up to upTo is in the data file for good, drop it (as
+	// far as the last write that ends by then). writers can still queue
+	// meanwhile, they just can't commit until the new file is in place
+	void cut(uint64_t upTo){
+		std::unique_lock<std::mutex> lk(mu);
+		while(busy)cv.wait(lk);
+		size_t k=0;
+		while(k<marks.size()&&marks[k].first<=upTo)++k;
+		if(k==0)return;
+		uint64_t base=marks[k-1].first+1;
+		off_t from=marks[k-1].second;
+		std::string tail=rdAt(from,fEnd-from);
+		if((off_t)tail.size()!=fEnd-from){
+			perror("Journal read failed");
+			exit(EXIT_FAILURE);
 		}
 		
-		while(node){
-			for(const auto& key:node->keys){
-				res.push_back(key);
-			}
-			node=node->next;
+		// the new file has to be complete and synced before it replaces
+		// the old one, and the rename synced before anything goes after it
+		std::string tmp=fn+".tmp";
+		int old=fd;
+		::unlink(tmp.c_str());
+		opn(tmp);
+		std::string h;
+		put64(h,MAGIC);
+		put64(h,base);
+		wAll(h);
+		wAll(tail);
+		dSync();
+		if(rename(tmp.c_str(),fn.c_str())!=0){
+			perror("Journal rename failed");
+			exit(EXIT_FAILURE);
 		}
-		return res;
+		size_t sl=fn.rfind('/');
+		std::string dir=sl==std::string::npos?".":fn.substr(0,sl+1);
+		int dfd=::open(dir.c_str(),O_RDONLY);
+		if(dfd<0||::fsync(dfd)!=0){
+			perror("Journal sync failed");
+			exit(EXIT_FAILURE);
+		}
+		::close(dfd);
+		::close(old);
+		
+		marks.erase(marks.begin(),marks.begin()+k);
+		for(auto& m:marks)m.second-=from-FHDR;
+		fEnd=FHDR+tail.size();
 	}
 };
 
-// the boss
-class SEng{
+// the cache
+// a fixed array of frames carved out of one page-aligned block that's
+// grabbed once up front (huge pages if asked). callers pin what they use
+// and unpin when done, pinned frames never get evicted.
+// pids are hashed over shards, each with its own lock, map and slice of
+// the frames, so hits on different shards never wait on each other.
+// unpinned frames sit on the shard's intrusive lru list so hit, miss and
+// evict stay O(1). no lock is held for disk io: a miss maps pid to a
+// frame marked io, lets go of the lock, writes a dirty victim back
+// through wb and reads pid in through rd. anyone else after the frame
+// waits on the shard's cv until that's done, and anyone after the
+// victim's pid waits until it's on disk (wOut).
+// a miss with every frame of its shard pinned waits for an unpin. nobody
+// holds more than a few pins at once, so MIN_SH frames a shard are
+// always enough to go round
+class BPool{
 private:
-	std::fstream dFile;
-	BPool bp;
-	BTree idx;
-	JMan jrnl;
-	uint64_t nextPid;
-	
-	std::shared_ptr<Pg> loadPg(uint64_t pid){
-		auto cached=bp.get(pid);
-		if(cached)return cached;
+	struct Frame{
+		Pg pg;
+		int pins;
+		bool io;      // being written out / read in by whoever mapped it
+		int64_t prev; // lru links, -1 = none
+		int64_t next;
+		std::shared_mutex* lt; // page bytes: shared to read, unique to change
 		
-		auto pg=std::make_shared<Pg>(pid);
-		dFile.seekg(pid*CFG::P_SZ);
-		dFile.read(pg->data,CFG::P_SZ);
+		Frame(char* buf,size_t pgSz,std::shared_mutex* l)
+			:pg(0,buf,pgSz),pins(0),io(false),prev(-1),next(-1),lt(l){}
+	};
+	
+	// frame f belongs to shard f%nSh
+	struct Shard{
+		std::mutex mu; // map, lru, pins and io of its frames
+		std::condition_variable cv; // a frame came free or finished its io
+		size_t waiting;
+		std::unordered_map<uint64_t,size_t> map;
+		std::unordered_set<uint64_t> wOut; // evicted, still being written back
+		std::vector<size_t> freeFr; // not holding a page
+		int64_t head; // most recently unpinned
+		int64_t tail; // next one out
 		
-		bp.put(pid,pg);
-		return pg;
+		Shard():waiting(0),head(-1),tail(-1){}
+	};
+	
+	char* mem;
+	size_t memSz;
+	std::vector<Frame> frames;
+	std::unique_ptr<std::shared_mutex[]> latches;
+	std::unique_ptr<Shard[]> shards;
+	size_t nSh;
+	
+	std::function<void(Pg&)> rd;
+	std::function<void(Pg&)> wb;
+	
+	Shard& shOf(uint64_t pid){
+		return shards[(pid*0x9E3779B97F4A7C15ULL>>32)&(nSh-1)];
 	}
 	
-	void flushPg(std::shared_ptr<Pg> pg){
-		dFile.seekp(pg->pid*CFG::P_SZ);
-		dFile.write(pg->data,CFG::P_SZ);
-		dFile.flush();
-		pg->drty=false;
+	void unlink(Shard& s,size_t f){
+		Frame& fr=frames[f];
+		if(fr.prev>=0)frames[fr.prev].next=fr.next;
+		else s.head=fr.next;
+		if(fr.next>=0)frames[fr.next].prev=fr.prev;
+		else s.tail=fr.prev;
+		fr.prev=fr.next=-1;
 	}
 	
-	uint64_t allocPg(){
-		return nextPid++;
+	void pushFront(Shard& s,size_t f){
+		Frame& fr=frames[f];
+		fr.prev=-1;
+		fr.next=s.head;
+		if(s.head>=0)frames[s.head].prev=f;
+		s.head=f;
+		if(s.tail<0)s.tail=f;
 	}
 	
-public:
-	SEng():nextPid(1){
-		dFile.open(CFG::D_FILE,
-			std::ios::in|std::ios::out|std::ios::binary);
-		
-		if(!dFile.is_open()){
-			dFile.open(CFG::D_FILE,
-				std::ios::out|std::ios::binary);
-			dFile.close();
-			dFile.open(CFG::D_FILE,
-				std::ios::in|std::ios::out|std::ios::binary);
-		}
-		
-		dFile.seekg(0,std::ios::end);
-		size_t fSz=dFile.tellg();
-		nextPid=(fSz/CFG::P_SZ)+1;
+	void wait(Shard& s,std::unique_lock<std::mutex>& lk){
+		s.waiting++;
+		s.cv.wait(lk);
+		s.waiting--;
 	}
 	
-	~SEng(){
-		flushAll();
-		if(dFile.is_open()){
-			dFile.close();
+	void wake(Shard& s){
+		if(s.waiting)s.cv.notify_all();
+	}
+	
+	// pid pinned. fill = it wasn't here: the frame is mapped to it and
+	// marked io, the caller fills it and calls done(). waits while the
+	// frame is in somebody else's io, while an old copy of pid is still
+	// going out, or while every frame is pinned. shard locked
+	size_t pin(Shard& s,std::unique_lock<std::mutex>& lk,uint64_t pid,bool& fill){
+		while(true){
+			auto it=s.map.find(pid);
+			if(it!=s.map.end()){
+				size_t f=it->second;
+				Frame& fr=frames[f];
+				if(fr.pins++==0)unlink(s,f);
+				while(fr.io)wait(s,lk);
+				fill=false;
+				return f;
+			}
+			if(!s.wOut.count(pid)&&(!s.freeFr.empty()||s.tail>=0))break;
+			wait(s,lk);
 		}
+		fill=true;
+		return grab(s,lk,pid);
 	}
 	
-	bool insert(const std::string& key,const std::string& val){
-		// check if it's already there
-		if(idx.search(key)!=0){
-			return false;
+	// a frame for pid, pinned, mapped and marked io. a dirty victim goes
+	// out through wb first, with the lock let go
+	size_t grab(Shard& s,std::unique_lock<std::mutex>& lk,uint64_t pid){
+		size_t f;
+		if(!s.freeFr.empty()){
+			f=s.freeFr.back();
+			s.freeFr.pop_back();
+		}else{
+			f=s.tail;
+			unlink(s,f);
+			s.map.erase(frames[f].pg.pid);
 		}
+		Frame& fr=frames[f];
+		fr.pins=1;
+		fr.io=true;
+		s.map[pid]=f;
 		
-		jrnl.logOp("INSERT",key,val);
-		
-		uint64_t pid=allocPg();
-		Rec rec(key,val,pid);
-		
-		auto pg=std::make_shared<Pg>(pid);
-		pg->wRec(rec);
-		
-		bp.put(pid,pg);
-		flushPg(pg);
-		
-		idx.insert(key,pid);
-		
-		jrnl.commit();
-		return true;
+		if(fr.pg.drty){
+			uint64_t old=fr.pg.pid;
+			s.wOut.insert(old);
+			lk.unlock();
+			wb(fr.pg);
+			lk.lock();
+			s.wOut.erase(old);
+			wake(s);
+		}
+		fr.pg.pid=pid;
+		fr.pg.drty=false;
+		fr.pg.chg++; // a flusher copy of the old page mustn't match
+		return f;
 	}
 	
-	std::pair<bool,std::string> get(const std::string& key){
-		uint64_t pid=idx.search(key);
-		if(pid==0){
-			return {false,""};
+	// io on a frame from pin() is over
+	void done(Shard& s,size_t f){
+		std::lock_guard<std::mutex> lk(s.mu);
+		frames[f].io=false;
+		wake(s);
+	}
+	
+	void unpin(size_t f){
+		Shard& s=shards[f%nSh];
+		std::lock_guard<std::mutex> lk(s.mu);
+		if(--frames[f].pins==0){
+			pushFront(s,f);
+			wake(s);
 		}
+	}
+	
+	void release(){
+		if(mem)munmap(mem,memSz);
+		mem=nullptr;
+		frames.clear();
+		shards.reset();
+		nSh=0;
+	}
+	
+public:
+	// pinned page handle, unpins itself when it goes away.
+	// take latch() around touching the bytes, and let go of it before
+	// the ref goes (don't call into the pool while holding it)
+	class Ref{
+		BPool* bp;
+		size_t f;
+		Pg* pg;
+		std::shared_mutex* lt;
 		
-		auto pg=loadPg(pid);
-		Rec rec=pg->rRec();
+	public:
+		Ref():bp(nullptr),f(0),pg(nullptr),lt(nullptr){}
+		Ref(BPool* b,size_t fi):bp(b),f(fi),pg(&b->frames[fi].pg),lt(b->frames[fi].lt){}
+		Ref(Ref&& o):bp(o.bp),f(o.f),pg(o.pg),lt(o.lt){o.pg=nullptr;}
+		Ref& operator=(Ref&& o){
+			if(this!=&o){
+				reset();
+				bp=o.bp;
+				f=o.f;
+				pg=o.pg;
+				lt=o.lt;
+				o.pg=nullptr;
+			}
+			return *this;
+		}
+		Ref(const Ref&)=delete;
+		Ref& operator=(const Ref&)=delete;
+		~Ref(){reset();}
 		
-		if(rec.del){
-			return {false,""};
+		void reset(){
+			if(pg)bp->unpin(f);
+			pg=nullptr;
 		}
 		
-		return {true,rec.getV()};
+		Pg* operator->() const{return pg;}
+		Pg& operator*() const{return *pg;}
+		Pg* get() const{return pg;}
+		std::shared_mutex& latch() const{return *lt;}
+		explicit operator bool() const{return pg!=nullptr;}
+	};
+	
+	// fewest frames a pool gets, whatever it's asked for, and fewest a
+	// shard gets when the pool is split up
+	static constexpr size_t MIN_FR=16;
+	static constexpr size_t MIN_SH=16;
+	static constexpr size_t MAX_SH=64;
+	
+	BPool():mem(nullptr),memSz(0),nSh(0),
+		rd([](Pg&){}),wb([](Pg&){}){}
+	
+	BPool(size_t capacity,size_t pgSz=CFG::P_SZ,bool huge=false):BPool(){
+		setup(capacity,pgSz,huge);
 	}
 	
-	bool update(const std::string& key,const std::string& newVal){
-		uint64_t pid=idx.search(key);
-		if(pid==0){
-			return false;
-		}
-		
-		jrnl.logOp("UPDATE",key,newVal,pid);
-		
-		auto pg=loadPg(pid);
-		Rec rec=pg->rRec();
+	BPool(const BPool&)=delete;
+	BPool& operator=(const BPool&)=delete;
+	
+	~BPool(){
+		release();
+	}
+	
+	void setup(size_t capacity,size_t pgSz,bool huge=false){
+		release();
+		size_t cap=std::max(MIN_FR,capacity);
+		memSz=cap*pgSz;
 		
-		if(rec.del){
-			return false;
+		void* p=MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if(huge){
+			size_t hp=2u<<20;
+			size_t hSz=(memSz+hp-1)/hp*hp;
+			p=mmap(nullptr,hSz,PROT_READ|PROT_WRITE,
+				   MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+			if(p!=MAP_FAILED)memSz=hSz;
 		}
+#endif
+		if(p==MAP_FAILED){
+			p=mmap(nullptr,memSz,PROT_READ|PROT_WRITE,
+				   MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+			if(p==MAP_FAILED){
+				perror("Buffer pool mmap failed");
+				exit(EXIT_FAILURE);
+			}
+#ifdef MADV_HUGEPAGE
+			if(huge)madvise(p,memSz,MADV_HUGEPAGE);
+#endif
+		}
+		mem=static_cast<char*>(p);
 		
-		strncpy(rec.val,newVal.c_str(),CFG::V_SZ-1);
-		pg->wRec(rec);
-		flushPg(pg);
-		
-		jrnl.commit();
-		return true;
+		nSh=1;
+		while(nSh*2<=MAX_SH&&cap/(nSh*2)>=MIN_SH)nSh*=2;
+		shards.reset(new Shard[nSh]);
+		latches.reset(new std::shared_mutex[cap]);
+		frames.reserve(cap);
+		for(size_t f=0;f<cap;++f){
+			frames.emplace_back(mem+f*pgSz,pgSz,&latches[f]);
+		}
+		for(size_t f=cap;f-->0;){
+			shards[f%nSh].freeFr.push_back(f);
+		}
+		for(size_t i=0;i<nSh;++i){
+			shards[i].map.reserve(cap/nSh+1);
+		}
 	}
 	
-	bool remove(const std::string& key){
-		uint64_t pid=idx.search(key);
-		if(pid==0){
-			return false;
+	void setIO(std::function<void(Pg&)> rdFn,std::function<void(Pg&)> wbFn){
+		rd=rdFn;
+		wb=wbFn;
+	}
+	
+	// pin pid, reading it in on a miss
+	Ref fetch(uint64_t pid,bool* hit=nullptr){
+		Shard& s=shOf(pid);
+		std::unique_lock<std::mutex> lk(s.mu);
+		bool fill;
+		size_t f=pin(s,lk,pid,fill);
+		lk.unlock();
+		if(fill){
+			rd(frames[f].pg);
+			done(s,f);
 		}
+		if(hit)*hit=!fill;
+		return Ref(this,f);
+	}
+	
+	// pin a brand new page, nothing to read
+	Ref fresh(uint64_t pid){
+		Shard& s=shOf(pid);
+		std::unique_lock<std::mutex> lk(s.mu);
+		bool fill;
+		size_t f=pin(s,lk,pid,fill);
+		lk.unlock();
 		
-		jrnl.logOp("DELETE",key,"",pid);
-		
-		auto pg=loadPg(pid);
-		Rec rec=pg->rRec();
-		rec.del=true;
-		
-		pg->wRec(rec);
-		flushPg(pg);
-		
-		idx.remove(key);
-		
-		jrnl.commit();
+		// it can be here already: a reader with an old rid read it back
+		// in after the file got cut back, whatever it saw is gone now
+		Pg& pg=frames[f].pg;
+		{
+			std::unique_lock<std::shared_mutex> l(*frames[f].lt);
+			memset(pg.data,0,pg.sz);
+			pg.init();
+			pg.bad=false;
+			if(!fill)pg.chg++;
+		}
+		if(fill)done(s,f);
+		return Ref(this,f);
+	}
+	
+	// forget pid without writing it back (its bytes on disk are about to
+	// go away). false if somebody has it pinned or it's still going out
+	bool drop(uint64_t pid){
+		Shard& s=shOf(pid);
+		std::lock_guard<std::mutex> lk(s.mu);
+		if(s.wOut.count(pid))return false;
+		auto it=s.map.find(pid);
+		if(it==s.map.end())return true;
+		size_t f=it->second;
+		Frame& fr=frames[f];
+		if(fr.pins>0)return false;
+		{
+			std::unique_lock<std::shared_mutex> l(*fr.lt);
+			fr.pg.drty=false;
+			fr.pg.chg++;
+		}
+		unlink(s,f);
+		s.map.erase(it);
+		s.freeFr.push_back(f);
+		wake(s);
 		return true;
 	}
 	
-	void flushAll(){
-		auto dirty=bp.getDirty();
-		for(auto& pg:dirty){
-			flushPg(pg);
+	// pin pid if it's here (and not in the middle of its io), empty ref
+	// otherwise. never reads or waits
+	Ref peek(uint64_t pid){
+		Shard& s=shOf(pid);
+		std::lock_guard<std::mutex> lk(s.mu);
+		auto it=s.map.find(pid);
+		if(it==s.map.end()||frames[it->second].io)return Ref();
+		if(frames[it->second].pins++==0)unlink(s,it->second);
+		return Ref(this,it->second);
+	}
+	
+	// pids of the dirty pages, in no order
+	std::vector<uint64_t> dirty(){
+		std::vector<uint64_t> res;
+		for(size_t i=0;i<nSh;++i){
+			Shard& s=shards[i];
+			std::lock_guard<std::mutex> lk(s.mu);
+			for(auto& pair:s.map){
+				Frame& fr=frames[pair.second];
+				if(!fr.io&&fr.pg.drty)res.push_back(pair.first);
+			}
 		}
-		jrnl.trunc();
+		return res;
 	}
 	
-	// slow way for benchmark
-	std::pair<bool,std::string> lSearch(const std::string& key){
-		dFile.seekg(0,std::ios::end);
-		size_t fSz=dFile.tellg();
-		size_t numPgs=fSz/CFG::P_SZ;
-		
-		for(uint64_t pid=1;pid<=numPgs;++pid){
-			dFile.seekg(pid*CFG::P_SZ);
-			char buf[CFG::P_SZ];
-			dFile.read(buf,CFG::P_SZ);
-			
-			Rec rec;
-			memcpy(&rec,buf,sizeof(Rec));
-			
-			if(!rec.del&&rec.getK()==key){
-				return {true,rec.getV()};
+	// lowest recLsn of any dirty page, counting ones on their way out,
+	// UINT64_MAX if none. a page that's clean by now is out of our hands
+	uint64_t minRecLsn(){
+		uint64_t m=UINT64_MAX;
+		for(size_t i=0;i<nSh;++i){
+			Shard& s=shards[i];
+			std::lock_guard<std::mutex> lk(s.mu);
+			for(auto& pair:s.map){
+				Pg& pg=frames[pair.second].pg;
+				if(pg.drty)m=std::min<uint64_t>(m,pg.recLsn);
 			}
 		}
-		return {false,""};
+		return m;
 	}
 	
-	void stats(){
-		dFile.seekg(0,std::ios::end);
-		size_t fSz=dFile.tellg();
-		size_t numPgs=fSz/CFG::P_SZ;
-		
-		std::cout<<"=== Database Statistics ==="<<std::endl;
-		std::cout<<"File size: "<<fSz<<" bytes"<<std::endl;
-		std::cout<<"Number of pages: "<<numPgs<<std::endl;
-		std::cout<<"Page size: "<<CFG::P_SZ<<" bytes"<<std::endl;
-		std::cout<<"Cache size: "<<CFG::C_SZ<<" pages"<<std::endl;
+	size_t size(){
+		size_t n=0;
+		for(size_t i=0;i<nSh;++i){
+			std::lock_guard<std::mutex> lk(shards[i].mu);
+			n+=shards[i].map.size();
+		}
+		return n;
+	}
+	
+	size_t capacity() const{
+		return frames.size();
+	}
+};
+
+// magic b-tree stuff
+// nodes are fixed size (room for B_ORD keys, the key bytes go in one
+// buffer per node) and live in slabs owned by the tree, they point at
+// each other by number instead of shared_ptr. a descent is just array
+// reads: no refcounts, no allocation
+typedef uint32_t NodeId;
+constexpr NodeId NIL=0xFFFFFFFFu;
+
+// first 8 bytes of a key as a big endian number (zero padded), so
+// heads compare as integers in the same order the bytes do
+inline uint64_t kHead(const char* p,size_t len){
+	unsigned char b[8]={0};
+	if(len)memcpy(b,p,std::min<size_t>(len,8));
+	uint64_t h=0;
+	for(int i=0;i<8;++i)h=h<<8|b[i];
+	return h;
+}
+
+// in-node search over the heads: how many of the n sorted heads are < h
+// (lt) and <= h (le), so the keys in [lt,le) are the ones that tie.
+// three probes (heads 15, 31, 47, no branches, the loads can all miss at
+// once) pick the block of 16 that h falls in, then one AVX2 compare does
+// 4 heads of it (2 with SSE4.2). the compare is signed, so both sides get
+// their top bit flipped first. without either it's a plain binary search.
+// the vector loads read whole blocks, past n but never past B_ORD.
+// leaves keep the binary search: on a tree bigger than the cache the leaf
+// is nearly always a miss, and there the predicted branches start loading
+// the key bytes early and that wins. the inner nodes stay hot
+static_assert(CFG::B_ORD%16==0,"heads are searched 16 at a time");
+
+inline int pickSimd(){
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))return 2;
+	if(__builtin_cpu_supports("sse4.2"))return 1;
+#endif
+	return 0;
+}
+
+// 2 = avx2, 1 = sse4.2, 0 = scalar. set once from the cpu, the
+// benchmark flips it to compare
+inline int simdLvl=pickSimd();
+
+// first head of the block of 16 that h falls in
+inline size_t hBlock(const uint64_t* hd,size_t n,uint64_t h){
+	size_t b=0;
+	for(size_t p=15;p+16<CFG::B_ORD;p+=16){
+		b+=((p<n)&(hd[p]<h))*16;
+	}
+	return b;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+inline size_t hLtAvx2(const uint64_t* hd,size_t n,uint64_t h){
+	const __m256i flip=_mm256_set1_epi64x(LLONG_MIN);
+	const __m256i hv=_mm256_xor_si256(_mm256_set1_epi64x(h),flip);
+	size_t b=hBlock(hd,n,h);
+	size_t lt=b;
+	for(size_t i=b;i<b+16&&i<n;i+=4){
+		__m256i v=_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(hd+i)),flip);
+		unsigned m=n-i>=4?0xF:(1u<<(n-i))-1;
+		unsigned ls=_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(hv,v)))&m;
+		lt+=__builtin_popcount(ls);
+	}
+	return lt;
+}
+
+__attribute__((target("sse4.2")))
+inline size_t hLtSse42(const uint64_t* hd,size_t n,uint64_t h){
+	const __m128i flip=_mm_set1_epi64x(LLONG_MIN);
+	const __m128i hv=_mm_xor_si128(_mm_set1_epi64x(h),flip);
+	size_t b=hBlock(hd,n,h);
+	size_t lt=b;
+	for(size_t i=b;i<b+16&&i<n;i+=2){
+		__m128i v=_mm_xor_si128(_mm_loadu_si128((const __m128i*)(hd+i)),flip);
+		unsigned m=n-i>=2?0x3:0x1;
+		unsigned ls=_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(hv,v)))&m;
+		lt+=__builtin_popcount(ls);
+	}
+	return lt;
+}
+#endif
+
+inline void hCnt(const uint64_t* hd,size_t n,uint64_t h,bool vec,size_t& lt,size_t& le){
+#if defined(__x86_64__)
+	if(vec&&simdLvl>0){
+		lt=simdLvl==2?hLtAvx2(hd,n,h):hLtSse42(hd,n,h);
+		le=lt<n&&hd[lt]==h?std::upper_bound(hd+lt,hd+n,h)-hd:lt;
+		return;
+	}
+#endif
+	lt=std::lower_bound(hd,hd+n,h)-hd;
+	le=std::upper_bound(hd+lt,hd+n,h)-hd;
+}
+
+// keys are stored once per node as prefix + suffixes in kb, every key
+// in the node starts with kb[0..pfx). head[i] caches the first 8 suffix
+// bytes, so a search mostly compares integers and only looks at the
+// bytes in kb when two heads tie
+struct BNode{
+	bool leaf;
+	uint16_t n;      // keys in use
+	NodeId next;     // leaf chain
+	NodeId prev;
+	uint16_t pfx;
+	uint32_t dead;   // kb bytes no key points at anymore
+	alignas(64) uint64_t head[CFG::B_ORD]; // 16 of them = 2 cache lines
+	uint32_t off[CFG::B_ORD];    // suffix i = kb[off[i]..off[i]+len[i])
+	uint16_t len[CFG::B_ORD];
+	uint64_t vals[CFG::B_ORD];   // leaves only
+	NodeId kids[CFG::B_ORD+1];   // inner nodes only, n+1 of them
+	std::vector<char> kb;
+	
+	BNode():leaf(true),n(0),next(NIL),prev(NIL),pfx(0),dead(0),head{}{}
+	
+	std::string key(size_t i) const{
+		std::string k(kb.data(),pfx);
+		k.append(kb.data()+off[i],len[i]);
+		return k;
+	}
+	
+	// k against the prefix: <0 sorts before every key here, >0 after
+	// every key, 0 = k starts with the prefix
+	int vsPfx(const char* k,size_t kl) const{
+		if(pfx==0)return 0;
+		int c=memcmp(k,kb.data(),std::min<size_t>(kl,pfx));
+		if(c!=0)return c;
+		return kl<pfx?-1:0;
+	}
+	
+	// suffix i against s (k minus the prefix), h = kHead(s)
+	int cmpAt(size_t i,uint64_t h,const char* s,size_t sl) const{
+		if(head[i]!=h)return head[i]<h?-1:1;
+		return cmpTie(i,s,sl);
+	}
+	
+	// same, for a suffix whose head ties with the one of s: the first
+	// min(len,sl,8) bytes match already
+	int cmpTie(size_t i,const char* s,size_t sl) const{
+		size_t m=std::min<size_t>(len[i],sl);
+		size_t sk=std::min<size_t>(m,8);
+		if(m>sk){
+			int c=memcmp(kb.data()+off[i]+sk,s+sk,m-sk);
+			if(c!=0)return c;
+		}
+		return len[i]<sl?-1:len[i]>sl?1:0;
+	}
+	
+	// key(i) against k
+	int cmp(size_t i,const std::string& k) const{
+		int c=vsPfx(k.data(),k.size());
+		if(c!=0)return c<0?1:-1;
+		const char* s=k.data()+pfx;
+		size_t sl=k.size()-pfx;
+		return cmpAt(i,kHead(s,sl),s,sl);
+	}
+	
+	bool keyIs(size_t i,const std::string& k) const{
+		return k.size()==pfx+len[i]&&cmp(i,k)==0;
+	}
+	
+	// first i with key(i) >= k, or > k if upper
+	size_t bound(const std::string& k,bool upper) const{
+		int c=vsPfx(k.data(),k.size());
+		if(c<0)return 0;
+		if(c>0)return n;
+		const char* s=k.data()+pfx;
+		size_t sl=k.size()-pfx;
+		size_t lo,hi;
+		hCnt(head,n,kHead(s,sl),!leaf,lo,hi);
+		// only the keys whose head ties need their bytes looked at
+		while(lo<hi){
+			size_t mid=(lo+hi)/2;
+			int r=cmpTie(mid,s,sl);
+			if(r<0||(upper&&r==0))lo=mid+1;
+			else hi=mid;
+		}
+		return lo;
+	}
+	
+	size_t findPos(const std::string& key) const{
+		return bound(key,false);
+	}
+	
+	// key(i) is the first key under kids[i+1]
+	size_t kidPos(const std::string& key) const{
+		return bound(key,true);
+	}
+	
+	// rewrite kb with a prefix of p bytes and no dead bytes. p can be
+	// anything up to what key 0 and key n-1 have in common
+	void repack(size_t p){
+		std::vector<char> nb;
+		nb.reserve(kb.size()+n*(pfx>p?pfx-p:0));
+		if(p<=pfx)nb.insert(nb.end(),kb.begin(),kb.begin()+p);
+		else{
+			nb.insert(nb.end(),kb.begin(),kb.begin()+pfx);
+			nb.insert(nb.end(),kb.begin()+off[0],kb.begin()+off[0]+(p-pfx));
+		}
+		for(size_t i=0;i<n;++i){
+			uint32_t o=nb.size();
+			if(p<=pfx){
+				nb.insert(nb.end(),kb.begin()+p,kb.begin()+pfx);
+				nb.insert(nb.end(),kb.begin()+off[i],kb.begin()+off[i]+len[i]);
+				len[i]+=pfx-p;
+			}else{
+				nb.insert(nb.end(),kb.begin()+off[i]+(p-pfx),kb.begin()+off[i]+len[i]);
+				len[i]-=p-pfx;
+			}
+			off[i]=o;
+			head[i]=kHead(nb.data()+o,len[i]);
+		}
+		kb.swap(nb);
+		pfx=p;
+		dead=0;
+	}
+	
+	// stretch the prefix as far as the keys allow. they're sorted, so
+	// what the first and last share everybody shares
+	void tighten(){
+		if(n==0){
+			repack(0);
+			return;
+		}
+		const char* a=kb.data()+off[0];
+		const char* b=kb.data()+off[n-1];
+		size_t m=std::min(len[0],len[n-1]);
+		size_t c=0;
+		while(c<m&&a[c]==b[c])c++;
+		repack(pfx+c);
+	}
+	
+	void putKey(size_t i,const char* k,size_t kl){
+		if(vsPfx(k,kl)!=0){
+			// k doesn't fit the prefix, cut it back to what they share
+			size_t c=0;
+			size_t m=std::min<size_t>(kl,pfx);
+			while(c<m&&k[c]==kb[c])c++;
+			repack(c);
+		}
+		off[i]=kb.size();
+		len[i]=kl-pfx;
+		kb.insert(kb.end(),k+pfx,k+kl);
+		head[i]=kHead(k+pfx,kl-pfx);
+	}
+	
+	// bytes pile up as keys leave or get replaced, squeeze them out
+	// once they're half of kb
+	void squeeze(){
+		if(dead>64&&dead*2>kb.size())repack(pfx);
+	}
+	
+	void insKey(size_t i,const char* k,size_t kl){
+		memmove(head+i+1,head+i,(n-i)*sizeof(uint64_t));
+		memmove(off+i+1,off+i,(n-i)*sizeof(uint32_t));
+		memmove(len+i+1,len+i,(n-i)*sizeof(uint16_t));
+		len[i]=0;
+		n++;
+		putKey(i,k,kl);
+	}
+	
+	void insKey(size_t i,const std::string& k){
+		insKey(i,k.data(),k.size());
+	}
+	
+	void eraseKey(size_t i){
+		uint16_t l=len[i];
+		memmove(head+i,head+i+1,(n-i-1)*sizeof(uint64_t));
+		memmove(off+i,off+i+1,(n-i-1)*sizeof(uint32_t));
+		memmove(len+i,len+i+1,(n-i-1)*sizeof(uint16_t));
+		n--;
+		dead+=l;
+		squeeze();
+	}
+	
+	void setKey(size_t i,const std::string& k){
+		dead+=len[i];
+		len[i]=0;
+		putKey(i,k.data(),k.size());
+		squeeze();
+	}
+	
+	void insLeaf(size_t i,const std::string& key,uint64_t val){
+		memmove(vals+i+1,vals+i,(n-i)*sizeof(uint64_t));
+		vals[i]=val;
+		insKey(i,key);
+	}
+	
+	void eraseLeaf(size_t i){
+		memmove(vals+i,vals+i+1,(n-i-1)*sizeof(uint64_t));
+		eraseKey(i);
+	}
+	
+	// key goes in at i, kid right after it (kids[i] just split into two)
+	void insInner(size_t i,const std::string& key,NodeId kid){
+		memmove(kids+i+2,kids+i+1,(n-i)*sizeof(NodeId));
+		kids[i+1]=kid;
+		insKey(i,key);
+	}
+	
+	// drops key(i) and kids[i+1]
+	void eraseInner(size_t i){
+		memmove(kids+i+1,kids+i+2,(n-i-1)*sizeof(NodeId));
+		eraseKey(i);
+	}
+	
+	void pushFront(const std::string& key,NodeId kid){
+		memmove(kids+1,kids,(n+1)*sizeof(NodeId));
+		kids[0]=kid;
+		insKey(0,key);
+	}
+	
+	void popFront(){
+		memmove(kids,kids+1,n*sizeof(NodeId));
+		eraseKey(0);
+	}
+	
+	// keep the first m keys
+	void cut(size_t m){
+		for(size_t i=m;i<n;++i)dead+=len[i];
+		n=m;
+		tighten();
+	}
+	
+	// empty node takes keys [a,b) of s as they are, same prefix
+	void copyKeys(const BNode& s,size_t a,size_t b){
+		kb.assign(s.kb.begin(),s.kb.begin()+s.pfx);
+		pfx=s.pfx;
+		dead=0;
+		for(size_t i=a;i<b;++i,++n){
+			off[n]=kb.size();
+			len[n]=s.len[i];
+			head[n]=s.head[i];
+			kb.insert(kb.end(),s.kb.begin()+s.off[i],s.kb.begin()+s.off[i]+s.len[i]);
+		}
+		tighten();
+	}
+};
+
+class BTree{
+private:
+	// slabs never move once allocated, so a BNode& stays good while
+	// more nodes get handed out
+	static constexpr size_t SLAB=256;
+	std::vector<std::unique_ptr<BNode[]>> slabs;
+	std::vector<NodeId> freeN;
+	NodeId used;
+	NodeId root;
+	size_t ord;
+	
+	// a tree opened from index.dat starts with just its root. every other
+	// node is still only in the image, and a link to it holds LAZY|its page
+	// there. lnk() reads it in (through ipool) the first time a descent or
+	// a leaf walk gets to it, so opening costs the pages that get touched.
+	// readers can do that under a shared tMu: lzMu keeps them one at a time,
+	// the link gets the new id with a release store, and slabs has room
+	// reserved for every node the image still has so it never moves under
+	// a reader
+	static constexpr NodeId LAZY=0x80000000u;
+	int imgFd;
+	uint64_t imgPgs;
+	std::unique_ptr<BPool> ipool;
+	std::unordered_map<uint64_t,NodeId> faulted; // image page -> node
+	size_t pend; // image nodes not read in yet
+	std::mutex lzMu;
+	
+	BNode& nd(NodeId id){
+		return slabs[id/SLAB][id%SLAB];
+	}
+	
+	const BNode& nd(NodeId id) const{
+		return slabs[id/SLAB][id%SLAB];
+	}
+	
+	NodeId alloc(bool leaf){
+		NodeId id;
+		if(!freeN.empty()){
+			id=freeN.back();
+			freeN.pop_back();
+		}else{
+			if(used%SLAB==0){
+				size_t want=(used+pend)/SLAB+2;
+				if(slabs.capacity()<want)slabs.reserve(want*2);
+				slabs.emplace_back(new BNode[SLAB]);
+			}
+			id=used++;
+		}
+		BNode& b=nd(id);
+		b.leaf=leaf;
+		b.n=0;
+		b.next=b.prev=NIL;
+		b.pfx=0;
+		b.dead=0;
+		b.kb.clear();
+		return id;
+	}
+	
+	void release(NodeId id){
+		BNode& b=nd(id);
+		std::vector<char>().swap(b.kb);
+		b.n=0;
+		freeN.push_back(id);
+	}
+	
+	// forget index.dat, only call it once no link points into it
+	void dropImg(){
+		std::lock_guard<std::mutex> lk(lzMu);
+		if(imgFd>=0)::close(imgFd);
+		imgFd=-1;
+		imgPgs=0;
+		ipool.reset();
+		faulted.clear();
+		pend=0;
+	}
+	
+	// the node a link names, read in from index.dat if it's still there
+	NodeId lnk(NodeId& ref){
+		NodeId id=__atomic_load_n(&ref,__ATOMIC_ACQUIRE);
+		if(id==NIL||!(id&LAZY))return id;
+		return fault(ref,id&~LAZY);
+	}
+	
+	NodeId fault(NodeId& ref,uint64_t ipg){
+		std::lock_guard<std::mutex> lk(lzMu);
+		NodeId id=__atomic_load_n(&ref,__ATOMIC_ACQUIRE);
+		if(!(id&LAZY))return id; // somebody else read it in
+		
+		// a leaf is linked from its parent and both neighbours
+		auto it=faulted.find(ipg);
+		if(it==faulted.end()){
+			pend--;
+			id=rNode(ipg);
+			if(id==NIL){
+				std::cerr<<"index.dat is damaged (node at page "<<ipg
+						 <<"), delete it to rebuild the index"<<std::endl;
+				exit(EXIT_FAILURE);
+			}
+			it=faulted.emplace(ipg,id).first;
+		}
+		__atomic_store_n(&ref,it->second,__ATOMIC_RELEASE);
+		return it->second;
+	}
+	
+	// throw every node away and start over with one empty leaf
+	void reset(){
+		dropImg();
+		slabs.clear();
+		freeN.clear();
+		used=0;
+		root=alloc(true);
+	}
+	
+	NodeId split(NodeId id){
+		NodeId nid=alloc(nd(id).leaf);
+		BNode& node=nd(id);
+		BNode& nn=nd(nid);
+		size_t mid=node.n/2;
+		
+		if(node.leaf){
+			nn.copyKeys(node,mid,node.n);
+			memcpy(nn.vals,node.vals+mid,(node.n-mid)*sizeof(uint64_t));
+			NodeId nx=lnk(node.next);
+			nn.next=nx;
+			nn.prev=id;
+			if(nx!=NIL)nd(nx).prev=nid;
+			node.next=nid;
+		}else{
+			nn.copyKeys(node,mid+1,node.n);
+			memcpy(nn.kids,node.kids+mid+1,(node.n-mid)*sizeof(NodeId));
+		}
+		node.cut(mid);
+		
+		return nid;
+	}
+	
+	std::pair<NodeId,std::string>
+	insInt(NodeId id,const std::string& key,uint64_t val){
+		BNode& node=nd(id);
+		if(node.leaf){
+			size_t pos=node.findPos(key);
+			
+			if(pos<node.n&&node.keyIs(pos,key)){
+				node.vals[pos]=val; // update
+				return std::make_pair(NIL,"");
+			}
+			
+			node.insLeaf(pos,key,val);
+			
+			if(node.n>=ord){
+				NodeId nid=split(id);
+				return std::make_pair(nid,nd(nid).key(0));
+			}
+			return std::make_pair(NIL,"");
+		}else{
+			size_t pos=node.kidPos(key);
+			
+			auto res=insInt(lnk(node.kids[pos]),key,val);
+			
+			if(res.first!=NIL){
+				node.insInner(pos,res.second,res.first);
+				
+				if(node.n>=ord){
+					// middle key moves up, it doesn't stay in either half
+					std::string midKey=node.key(node.n/2);
+					NodeId nid=split(id);
+					return std::make_pair(nid,midKey);
+				}
+			}
+			return std::make_pair(NIL,"");
+		}
+	}
+	
+	// fewest keys a node other than the root should keep
+	size_t minKeys() const{
+		return (ord-1)/2;
+	}
+	
+	// kids[j+1] goes into kids[j], the separator between them comes down
+	void merge(NodeId par,size_t j){
+		BNode& p=nd(par);
+		NodeId ai=lnk(p.kids[j]);
+		NodeId bi=lnk(p.kids[j+1]);
+		BNode& a=nd(ai);
+		BNode& b=nd(bi);
+		if(a.leaf){
+			for(size_t k=0;k<b.n;++k)a.insLeaf(a.n,b.key(k),b.vals[k]);
+			a.next=lnk(b.next);
+			if(a.next!=NIL)nd(a.next).prev=ai;
+		}else{
+			a.insInner(a.n,p.key(j),b.kids[0]);
+			for(size_t k=0;k<b.n;++k)a.insInner(a.n,b.key(k),b.kids[k+1]);
+		}
+		p.eraseInner(j);
+		release(bi);
+	}
+	
+	// kids[i] fell under minKeys: borrow from a sibling that can spare
+	// one, otherwise merge with one
+	void fixKid(NodeId par,size_t i){
+		BNode& p=nd(par);
+		BNode& kid=nd(lnk(p.kids[i]));
+		BNode* lft=i>0?&nd(lnk(p.kids[i-1])):nullptr;
+		BNode* rgt=i<p.n?&nd(lnk(p.kids[i+1])):nullptr;
+		
+		if(lft&&lft->n>minKeys()){
+			size_t l=lft->n-1;
+			if(kid.leaf){
+				kid.insLeaf(0,lft->key(l),lft->vals[l]);
+				p.setKey(i-1,kid.key(0));
+			}else{
+				kid.pushFront(p.key(i-1),lft->kids[l+1]);
+				p.setKey(i-1,lft->key(l));
+			}
+			lft->cut(l);
+		}else if(rgt&&rgt->n>minKeys()){
+			if(kid.leaf){
+				kid.insLeaf(kid.n,rgt->key(0),rgt->vals[0]);
+				rgt->eraseLeaf(0);
+				p.setKey(i,rgt->key(0));
+			}else{
+				kid.insInner(kid.n,p.key(i),rgt->kids[0]);
+				p.setKey(i,rgt->key(0));
+				rgt->popFront();
+			}
+		}else if(lft){
+			merge(par,i-1);
+		}else if(rgt){
+			merge(par,i);
+		}
+	}
+	
+	// true if node ended up under minKeys and its parent has to fix it
+	bool delInt(NodeId id,const std::string& key){
+		BNode& node=nd(id);
+		if(node.leaf){
+			size_t pos=node.findPos(key);
+			if(pos<node.n&&node.keyIs(pos,key)){
+				node.eraseLeaf(pos);
+			}
+			return node.n<minKeys();
+		}
+		
+		size_t pos=node.kidPos(key);
+		if(delInt(lnk(node.kids[pos]),key)){
+			fixKid(id,pos);
+		}
+		return node.n<minKeys();
+	}
+	
+	// leftmost leaf
+	NodeId first(){
+		NodeId id=root;
+		while(!nd(id).leaf)id=lnk(nd(id).kids[0]);
+		return id;
+	}
+	
+	// index.dat layout:
+	// page 0 = meta: magic, clean, root page, data pages at save time,
+	//          aux page, aux bytes, nodes
+	// then one run of pages per node, kids written before parents, then
+	// aux: whatever the owner wants kept next to the index
+	// node = leaf(2) run(2) n(2) next(8) prev(8) (leaf neighbours' pages,
+	//        0 = none) then n x [klen(2) key (val(8) if leaf)]
+	//        and n+1 kid page ids if it's not a leaf
+	static constexpr uint64_t MAGIC=0x3258444E49425442ULL;
+	static constexpr size_t NHDR=22;
+	
+	// leaves = their pages left to right, for the links
+	uint64_t wNode(std::ofstream& f,NodeId id,uint64_t& nxt,
+				   std::vector<uint64_t>& leaves){
+		BNode& node=nd(id);
+		std::vector<uint64_t> kidPgs;
+		if(!node.leaf){
+			for(size_t i=0;i<=node.n;++i){
+				kidPgs.push_back(wNode(f,lnk(node.kids[i]),nxt,leaves));
+			}
+		}else{
+			// nothing may still point into the old image once we're done
+			lnk(node.next);
+			lnk(node.prev);
+		}
+		
+		std::string b;
+		put16(b,node.leaf);
+		put16(b,0);
+		put16(b,node.n);
+		put64(b,0);
+		put64(b,0);
+		for(size_t i=0;i<node.n;++i){
+			put16(b,node.pfx+node.len[i]);
+			b.append(node.kb.data(),node.pfx);
+			b.append(node.kb.data()+node.off[i],node.len[i]);
+			if(node.leaf)put64(b,node.vals[i]);
+		}
+		for(auto kp:kidPgs)put64(b,kp);
+		
+		size_t run=(b.size()+CFG::P_SZ-1)/CFG::P_SZ;
+		b.resize(run*CFG::P_SZ,'\0');
+		uint16_t r=run;
+		memcpy(&b[2],&r,2);
+		
+		uint64_t me=nxt;
+		nxt+=run;
+		f.seekp(me*CFG::P_SZ);
+		f.write(b.data(),b.size());
+		if(node.leaf)leaves.push_back(me);
+		return me;
+	}
+	
+	// image pages [ipg, ipg+cnt) on the end of b
+	bool rdImg(uint64_t ipg,size_t cnt,std::string& b){
+		if(ipg==0||ipg+cnt>imgPgs)return false;
+		for(size_t j=0;j<cnt;++j){
+			auto pg=ipool->fetch(ipg+j);
+			std::shared_lock<std::shared_mutex> l(pg.latch());
+			b.append(pg->data,CFG::P_SZ);
+		}
+		return true;
+	}
+	
+	// links to image pages, 0 = none
+	static NodeId lazyTo(uint64_t ipg){
+		return ipg==0?NIL:LAZY|(NodeId)ipg;
+	}
+	
+	// one node from the image, its kids and neighbours stay lazy
+	NodeId rNode(uint64_t ipg){
+		std::string b;
+		if(!rdImg(ipg,1,b))return NIL;
+		size_t run=get16(&b[2]);
+		if(run>1&&!rdImg(ipg+1,run-1,b))return NIL;
+		
+		size_t n=get16(&b[4]);
+		if(n>=ord)return NIL; // saved with a bigger order than we have room for
+		NodeId id=alloc(get16(&b[0])!=0);
+		BNode& node=nd(id);
+		size_t off=NHDR;
+		for(size_t i=0;i<n;++i){
+			if(off+2>b.size())return NIL;
+			size_t kl=get16(&b[off]);
+			off+=2;
+			if(off+kl+8>b.size())return NIL;
+			if(node.leaf){
+				// val 0 = tombstone from before deletes were real
+				uint64_t v=get64(&b[off+kl]);
+				if(v!=0){
+					node.vals[node.n]=v;
+					node.insKey(node.n,&b[off],kl);
+				}
+				off+=kl+8;
+			}else{
+				node.insKey(node.n,&b[off],kl);
+				off+=kl;
+			}
+		}
+		
+		node.tighten();
+		if(node.leaf){
+			node.next=lazyTo(get64(&b[6]));
+			node.prev=lazyTo(get64(&b[14]));
+			return id;
+		}
+		
+		if(off+(n+1)*8>b.size())return NIL;
+		for(size_t i=0;i<=n;++i){
+			uint64_t kp=get64(&b[off+i*8]);
+			if(kp==0||kp>=LAZY)return NIL;
+			node.kids[i]=lazyTo(kp);
+		}
+		return id;
+	}
+	
+	static void wMeta(std::ostream& f,uint64_t clean,uint64_t rootPg,
+					  uint64_t dataPgs,uint64_t auxPg=0,uint64_t auxLen=0,
+					  uint64_t nodes=0){
+		std::string m;
+		put64(m,MAGIC);
+		put64(m,clean);
+		put64(m,rootPg);
+		put64(m,dataPgs);
+		put64(m,auxPg);
+		put64(m,auxLen);
+		put64(m,nodes);
+		m.resize(CFG::P_SZ,'\0');
+		f.seekp(0);
+		f.write(m.data(),m.size());
+	}
+
+public:
+	// a node holds at most B_ORD keys, so that's also the biggest order
+	BTree(size_t treeOrd=CFG::B_ORD)
+		:used(0),ord(std::min(std::max<size_t>(treeOrd,3),CFG::B_ORD)),
+		 imgFd(-1),imgPgs(0),pend(0){
+		root=alloc(true);
+	}
+	
+	BTree(const BTree&)=delete;
+	BTree& operator=(const BTree&)=delete;
+	
+	~BTree(){
+		dropImg();
+	}
+	
+	void insert(const std::string& key,uint64_t pid){
+		auto res=insInt(root,key,pid);
+		
+		if(res.first!=NIL){
+			// root split
+			NodeId nr=alloc(false);
+			BNode& r=nd(nr);
+			r.kids[0]=root;
+			r.kids[1]=res.first;
+			r.insKey(0,res.second);
+			root=nr;
+		}
+	}
+	
+	// insert() for keys in ascending order, no repeats. stays in the
+	// leaf while the keys fall in its range and it has room, so it's one
+	// descent per run of keys that share a leaf (plus one per split)
+	void insertSorted(const std::vector<std::pair<const std::string*,uint64_t>>& kv){
+		NodeId leaf=NIL;
+		std::string hi; // leaf holds keys < hi
+		bool top=true;  // no hi, it's the last leaf
+		
+		for(const auto& e:kv){
+			const std::string& key=*e.first;
+			if(leaf==NIL||(!top&&!(key<hi))){
+				leaf=root;
+				top=true;
+				while(!nd(leaf).leaf){
+					BNode& node=nd(leaf);
+					size_t pos=node.kidPos(key);
+					if(pos<node.n){
+						hi=node.key(pos);
+						top=false;
+					}
+					leaf=lnk(node.kids[pos]);
+				}
+			}
+			
+			BNode& node=nd(leaf);
+			size_t pos=node.findPos(key);
+			if(pos<node.n&&node.keyIs(pos,key)){
+				node.vals[pos]=e.second;
+			}else if(node.n<ord-1){
+				node.insLeaf(pos,key,e.second);
+			}else{
+				insert(key,e.second); // splits, so look again next time
+				leaf=NIL;
+			}
+		}
+	}
+	
+	uint64_t search(const std::string& key){
+		BNode* node=&nd(root);
+		
+		while(!node->leaf){
+			node=&nd(lnk(node->kids[node->kidPos(key)]));
+		}
+		
+		size_t pos=node->findPos(key);
+		if(pos<node->n&&node->keyIs(pos,key)){
+			return node->vals[pos];
+		}
+		return 0; // not found
+	}
+	
+	// search() for a sorted list of keys. stays in the current leaf (or
+	// steps to the next one) while the keys fall in it, instead of going
+	// back to the root for every key
+	std::vector<uint64_t> searchSorted(const std::vector<const std::string*>& keys){
+		std::vector<uint64_t> res;
+		res.reserve(keys.size());
+		BNode* leaf=nullptr;
+		
+		for(const std::string* kp:keys){
+			const std::string& key=*kp;
+			if(!leaf||leaf->n==0||leaf->cmp(leaf->n-1,key)<0){
+				BNode* nx=nullptr;
+				if(leaf&&leaf->next!=NIL)nx=&nd(lnk(leaf->next));
+				if(nx&&nx->n>0&&nx->cmp(0,key)<=0&&nx->cmp(nx->n-1,key)>=0){
+					leaf=nx;
+				}else{
+					leaf=&nd(root);
+					while(!leaf->leaf){
+						leaf=&nd(lnk(leaf->kids[leaf->kidPos(key)]));
+					}
+				}
+			}
+			
+			size_t pos=leaf->findPos(key);
+			if(pos<leaf->n&&leaf->keyIs(pos,key)){
+				res.push_back(leaf->vals[pos]);
+			}else{
+				res.push_back(0);
+			}
+		}
+		return res;
+	}
+	
+	// takes the key out for real, nodes that get too empty borrow or
+	// merge on the way back up and an empty root hands over to its kid
+	void remove(const std::string& key){
+		delInt(root,key);
+		while(!nd(root).leaf&&nd(root).n==0){
+			NodeId old=root;
+			root=lnk(nd(root).kids[0]);
+			release(old);
+		}
+	}
+	
+	size_t depth(){
+		size_t d=1;
+		for(NodeId id=root;!nd(id).leaf;id=lnk(nd(id).kids[0]))d++;
+		return d;
+	}
+	
+	// build the tree bottom-up from sorted, unique keys
+	// way cheaper than going through insInt one key at a time
+	void bulkLoad(const std::vector<std::pair<std::string,uint64_t>>& kv){
+		reset();
+		if(kv.empty())return;
+		
+		// leave some room so the first inserts don't split right away
+		size_t lCap=std::max<size_t>(2,(ord-1)*3/4);
+		size_t nLeaf=(kv.size()+lCap-1)/lCap;
+		
+		std::vector<NodeId> lvl;
+		std::vector<std::string> lows;
+		size_t at=0;
+		for(size_t i=0;i<nLeaf;++i){
+			// spread evenly so the last node isn't a runt
+			size_t cnt=kv.size()/nLeaf+(i<kv.size()%nLeaf?1:0);
+			NodeId id=i==0?root:alloc(true);
+			BNode& leaf=nd(id);
+			for(size_t j=0;j<cnt;++j,++at){
+				leaf.vals[j]=kv[at].second;
+				leaf.insKey(j,kv[at].first);
+			}
+			leaf.tighten();
+			if(!lvl.empty()){
+				nd(lvl.back()).next=id;
+				leaf.prev=lvl.back();
+			}
+			lows.push_back(leaf.key(0));
+			lvl.push_back(id);
+		}
+		
+		// stack inner levels until one node is left
+		while(lvl.size()>1){
+			size_t nNode=(lvl.size()+ord-1)/ord;
+			std::vector<NodeId> up;
+			std::vector<std::string> upLows;
+			at=0;
+			for(size_t i=0;i<nNode;++i){
+				size_t cnt=lvl.size()/nNode+(i<lvl.size()%nNode?1:0);
+				NodeId id=alloc(false);
+				BNode& node=nd(id);
+				upLows.push_back(lows[at]);
+				for(size_t j=0;j<cnt;++j,++at){
+					if(j>0)node.insKey(j-1,lows[at]);
+					node.kids[j]=lvl[at];
+				}
+				node.tighten();
+				up.push_back(id);
+			}
+			lvl.swap(up);
+			lows.swap(upLows);
+		}
+		root=lvl[0];
+	}
+	
+	// dump the whole tree to disk, marked clean. it goes to a temp file
+	// that's synced and renamed over fn, so a crash leaves either the old
+	// image or the new one. with sync off it's just handed to the os.
+	// writing it reads in whatever was still lazy
+	void save(const std::string& fn,uint64_t dataPgs,
+			  const std::string& aux="",bool sync=true){
+		std::string tmp=fn+".tmp";
+		{
+			std::ofstream f(tmp,std::ios::binary|std::ios::trunc);
+			wMeta(f,0,0,dataPgs);
+			uint64_t nxt=1;
+			std::vector<uint64_t> leaves;
+			uint64_t rootPg=wNode(f,root,nxt,leaves);
+			for(size_t i=0;i<leaves.size();++i){
+				std::string l;
+				put64(l,i+1<leaves.size()?leaves[i+1]:0);
+				put64(l,i>0?leaves[i-1]:0);
+				f.seekp(leaves[i]*CFG::P_SZ+6);
+				f.write(l.data(),l.size());
+			}
+			f.seekp(nxt*CFG::P_SZ);
+			f.write(aux.data(),aux.size());
+			wMeta(f,1,rootPg,dataPgs,nxt,aux.size(),used-freeN.size());
+			f.flush();
+			if(!f){
+				perror("Index write failed");
+				exit(EXIT_FAILURE);
+			}
+		}
+		if(sync)syncFile(tmp);
+		if(rename(tmp.c_str(),fn.c_str())!=0){
+			perror("Index rename failed");
+			exit(EXIT_FAILURE);
+		}
+		if(sync){
+			size_t sl=fn.rfind('/');
+			syncFile(sl==std::string::npos?".":fn.substr(0,sl+1));
+		}
+		dropImg(); // every link is a node id now
+	}
+	
+	// fsync a file (or a directory, for a rename in it)
+	static void syncFile(const std::string& fn){
+		int fd=::open(fn.c_str(),O_RDONLY);
+		if(fd<0||fsync(fd)!=0){
+			perror("Index sync failed");
+			exit(EXIT_FAILURE);
+		}
+		::close(fd);
+	}
+	
+	// only trust a clean image that matches the data file. only the root
+	// gets read now, the rest comes in as it's used
+	bool load(const std::string& fn,uint64_t dataPgs,std::string* aux=nullptr){
+		int fd=::open(fn.c_str(),O_RDONLY);
+		if(fd<0)return false;
+		
+		char m[CFG::P_SZ];
+		struct stat st;
+		if(::pread(fd,m,CFG::P_SZ,0)!=(ssize_t)CFG::P_SZ||fstat(fd,&st)!=0||
+		   get64(m)!=MAGIC||get64(m+8)!=1||get64(m+24)!=dataPgs||get64(m+48)==0){
+			::close(fd);
+			return false;
+		}
+		if(aux){
+			aux->assign(get64(m+40),'\0');
+			if(!aux->empty()&&::pread(fd,&(*aux)[0],aux->size(),
+									   get64(m+32)*CFG::P_SZ)!=(ssize_t)aux->size()){
+				::close(fd);
+				return false;
+			}
+		}
+		
+		reset();
+		imgFd=fd;
+		imgPgs=st.st_size/CFG::P_SZ;
+		ipool.reset(new BPool(64,CFG::P_SZ));
+		ipool->setIO([this](Pg& pg){
+			memset(pg.data,0,pg.sz);
+			if(::pread(imgFd,pg.data,pg.sz,pg.pid*pg.sz)<0){
+				perror("Index read failed");
+			}
+		},[](Pg&){});
+		
+		// the old root goes, a bad image leaves an empty tree behind
+		release(root);
+		pend=get64(m+48)-1;
+		size_t want=(used+pend)/SLAB+2;
+		if(slabs.capacity()<want)slabs.reserve(want*2);
+		uint64_t rootPg=get64(m+16);
+		root=rootPg<LAZY?rNode(rootPg):NIL;
+		if(root==NIL){
+			reset();
+			return false;
+		}
+		faulted[rootPg]=root;
+		return true;
+	}
+	
+	// once we start writing, the image on disk is out of date. has to be
+	// on disk before the first write after it commits, a crash would
+	// otherwise load the old image as if it were current
+	static void markStale(const std::string& fn){
+		int fd=::open(fn.c_str(),O_WRONLY);
+		if(fd<0){
+			if(errno==ENOENT)return;
+			perror("Index open failed");
+			exit(EXIT_FAILURE);
+		}
+		char z[8]={0};
+		if(pwrite(fd,z,8,8)!=8||fdatasync(fd)!=0){
+			perror("Index write failed");
+			exit(EXIT_FAILURE);
+		}
+		::close(fd);
+	}
+	
+	// up to n entries in key order, from <= key < to (from < key if
+	// !incl, to empty = no end). seeks once, then walks the leaf chain
+	std::vector<std::pair<std::string,uint64_t>>
+	range(const std::string& from,bool incl,const std::string& to,size_t n){
+		std::vector<std::pair<std::string,uint64_t>> res;
+		NodeId id=root;
+		while(!nd(id).leaf){
+			id=lnk(nd(id).kids[nd(id).kidPos(from)]);
+		}
+		
+		size_t pos=nd(id).findPos(from);
+		for(;id!=NIL&&res.size()<n;id=lnk(nd(id).next),pos=0){
+			const BNode& node=nd(id);
+			for(;pos<node.n&&res.size()<n;++pos){
+				std::string k=node.key(pos);
+				if(!to.empty()&&k>=to)return res;
+				if(!incl&&k==from)continue;
+				res.emplace_back(std::move(k),node.vals[pos]);
+			}
+		}
+		return res;
+	}
+	
+	// range() going down: up to n entries in descending order with
+	// lo <= key <= from (key < from if !incl, from ignored if top, which
+	// starts at the very last key). walks the leaf chain backwards
+	std::vector<std::pair<std::string,uint64_t>>
+	rangeRev(const std::string& from,bool incl,bool top,const std::string& lo,
+			 size_t n){
+		std::vector<std::pair<std::string,uint64_t>> res;
+		NodeId id=root;
+		while(!nd(id).leaf){
+			BNode& node=nd(id);
+			id=lnk(node.kids[top?node.n:node.kidPos(from)]);
+		}
+		
+		// one past the first key we may return
+		const BNode& leaf=nd(id);
+		size_t pos;
+		if(top)pos=leaf.n;
+		else if(incl)pos=leaf.kidPos(from);
+		else pos=leaf.findPos(from);
+		
+		while(id!=NIL&&res.size()<n){
+			BNode& node=nd(id);
+			while(pos>0&&res.size()<n){
+				--pos;
+				std::string k=node.key(pos);
+				if(k<lo)return res;
+				res.emplace_back(std::move(k),node.vals[pos]);
+			}
+			id=lnk(node.prev);
+			if(id!=NIL)pos=nd(id).n;
+		}
+		return res;
+	}
+	
+	std::vector<std::string> getAllKeys(){
+		std::vector<std::string> res;
+		
+		for(NodeId id=first();id!=NIL;id=lnk(nd(id).next)){
+			const BNode& node=nd(id);
+			for(size_t i=0;i<node.n;++i)res.push_back(node.key(i));
+		}
+		return res;
+	}
+};
+
+// the boss
+class SEng{
+private:
+	static constexpr uint64_t D_MAGIC=0x3154414442444244ULL;
+	
+	Opts opt;
+	int dFd;
+	BPool bp;
+	BTree idx;
+	JMan jrnl;
+	uint64_t nextPid;
+	uint64_t curPid; // page new records go into
+	// empty pages -> hole already punched. lowest pid gets used first so
+	// records drift to the front of the file and the end can be cut off.
+	// kept with the index at checkpoints, rebuild() finds them again
+	std::map<uint64_t,bool> freePgs;
+	bool canPunch;
+	bool idxSaved; // index.dat is the current checkpoint, no writes since
+	
+	// readers only take tMu shared and a page latch. writers still go
+	// one at a time through check -> log -> apply (page lsns have to
+	// follow log order for redo) but wait for the fsync after wMu.
+	// writes only touch the pool + journal, the flusher thread gets the
+	// pages out to database.dat.
+	// lock order: wMu -> tMu, wMu -> ioMu -> pool -> page latch, journal
+	// last (wbMu before all but wMu). nobody holds a pool lock or a latch
+	// while doing disk io
+	std::mutex wMu;         // one writer at a time
+	std::shared_mutex tMu;  // the tree
+	std::mutex ioMu;        // page writes, so an older image never lands last
+	std::mutex wbMu;        // one writeBack() at a time
+	std::thread flThr;
+	std::thread vacThr;
+	std::mutex flMu;        // flMu, flCv, flStop are for both threads
+	std::condition_variable flCv;
+	bool flStop;
+	
+	BPool::Ref loadPg(uint64_t pid){
+		return bp.fetch(pid);
+	}
+	
+	void readPg(Pg& pg){
+		memset(pg.data,0,pg.sz);
+		size_t got=0;
+		while(got<pg.sz){
+			ssize_t n=pread(dFd,pg.data+got,pg.sz-got,pg.pid*opt.pgSz+got);
+			if(n<0&&errno==EINTR)continue;
+			if(n<=0)break; // short read past eof is fine
+			got+=n;
+		}
+		pg.init();
+		pg.bad=!pg.sane();
+	}
+	
+	void wrAt(const char* p,size_t n,uint64_t off){
+		while(n>0){
+			ssize_t w=pwrite(dFd,p,n,off);
+			if(w<0){
+				if(errno==EINTR)continue;
+				perror("Data file write failed");
+				exit(EXIT_FAILURE);
+			}
+			p+=w;
+			n-=w;
+			off+=w;
+		}
+	}
+	
+	// one page out, its journal entries go first
+	void flushPg(Pg& pg){
+		jrnl.sync(pg.lsn());
+		std::lock_guard<std::mutex> io(ioMu);
+		wrAt(pg.data,opt.pgSz,pg.pid*opt.pgSz);
+		pg.drty=false;
+	}
+	
+	// page copy the flusher writes out
+	struct Img{
+		uint64_t pid;
+		uint64_t chg; // Pg::chg when it was copied
+		uint64_t lsn;
+		std::string data;
+		BPool::Ref pg; // pinned, so no other image of it lands meanwhile
+	};
+	
+	// a run of page images for consecutive pids in one pwritev
+	void wrRun(std::vector<Img*>& run){
+		if(run.empty())return;
+		std::vector<iovec> iov;
+		iov.reserve(run.size());
+		size_t tot=0;
+		for(auto* e:run){
+			iov.push_back({&e->data[0],e->data.size()});
+			tot+=e->data.size();
+		}
+		uint64_t off=run[0]->pid*opt.pgSz;
+		ssize_t w;
+		do{
+			w=pwritev(dFd,iov.data(),iov.size(),off);
+		}while(w<0&&errno==EINTR);
+		if(w!=(ssize_t)tot){
+			// partial or failed, fall back to one page at a time
+			for(auto* e:run){
+				wrAt(e->data.data(),e->data.size(),e->pid*opt.pgSz);
+			}
+		}
+		run.clear();
+	}
+	
+	// one flusher pass over the dirty pages, WB_BATCH at a time in pid
+	// order: pin and copy each under its own latch, make the journal
+	// durable up to them, write the copies with adjacent pages coalesced.
+	// the pins keep the pool from writing a newer image first, so a
+	// copy always goes out. a page that changed since its copy stays
+	// dirty, but everything up to the copy's lsn is on disk now
+	static constexpr size_t WB_BATCH=64;
+	void writeBack(){
+		std::lock_guard<std::mutex> one(wbMu);
+		std::vector<uint64_t> pids=bp.dirty();
+		std::sort(pids.begin(),pids.end());
+		
+		for(size_t b=0;b<pids.size();b+=WB_BATCH){
+			std::vector<Img> snap;
+			uint64_t maxLsn=0;
+			for(size_t j=b;j<pids.size()&&j<b+WB_BATCH;++j){
+				auto pg=bp.peek(pids[j]);
+				if(!pg)continue;
+				std::shared_lock<std::shared_mutex> l(pg.latch());
+				if(!pg->drty)continue;
+				maxLsn=std::max(maxLsn,pg->lsn());
+				snap.push_back({pids[j],pg->chg,pg->lsn(),std::string(pg->data,pg->sz),
+								BPool::Ref()});
+				l.unlock();
+				snap.back().pg=std::move(pg);
+			}
+			if(snap.empty())continue;
+			jrnl.sync(maxLsn);
+			
+			{
+				std::lock_guard<std::mutex> io(ioMu);
+				std::vector<Img*> run;
+				for(auto& e:snap){
+					if(!run.empty()&&(run.back()->pid+1!=e.pid||run.size()>=IOV_MAX)){
+						wrRun(run);
+					}
+					run.push_back(&e);
+				}
+				wrRun(run);
+			}
+			
+			for(auto& e:snap){
+				std::unique_lock<std::shared_mutex> l(e.pg.latch());
+				if(e.pg->chg==e.chg)e.pg->drty=false;
+				else if(e.pg->recLsn<=e.lsn)e.pg->recLsn=e.lsn+1;
+			}
+		}
+	}
+	
+	// the journal gets cut back once it's opt.ckptB long: whatever only
+	// touched pages that are on disk by now isn't needed anymore. no
+	// index.dat is written, after a crash from here the index gets
+	// rebuilt from the pages like any other time it's stale
+	void checkpoint(){
+		uint64_t last;
+		{
+			// every change logged so far is in its page by now
+			std::lock_guard<std::mutex> w(wMu);
+			last=jrnl.last();
+		}
+		// ioMu keeps shrink() from dropping a page it hasn't cut off yet
+		std::lock_guard<std::mutex> io(ioMu);
+		uint64_t m=bp.minRecLsn();
+		if(m==0)return;
+		if(opt.fsync&&fdatasync(dFd)!=0){
+			perror("Data file sync failed");
+			exit(EXIT_FAILURE);
+		}
+		jrnl.cut(std::min(last,m-1));
+	}
+	
+	void flusher(){
+		std::unique_lock<std::mutex> lk(flMu);
+		while(!flStop){
+			flCv.wait_for(lk,std::chrono::milliseconds(opt.flushMs));
+			if(flStop)break;
+			lk.unlock();
+			writeBack();
+			if(jrnl.size()>=opt.ckptB)checkpoint();
+			lk.lock();
+		}
+	}
+	
+	size_t fileSz(){
+		struct stat st;
+		if(fstat(dFd,&st)!=0)return 0;
+		return st.st_size;
+	}
+	
+	// lowest free page, otherwise a new one at the end. a free list from
+	// a checkpoint can name a page that got used again before a crash,
+	// that one just comes off the list
+	BPool::Ref allocPg(){
+		while(!freePgs.empty()){
+			uint64_t pid=freePgs.begin()->first;
+			freePgs.erase(freePgs.begin());
+			if(pid>=nextPid)continue;
+			auto pg=loadPg(pid);
+			std::unique_lock<std::shared_mutex> l(pg.latch());
+			if(pg->nSlot()==0&&!pg->bad){
+				l.unlock();
+				return pg;
+			}
+		}
+		return bp.fresh(nextPid++);
+	}
+	
+	// a page that just lost its last record goes on the free list.
+	// page latched, wMu held
+	void freeIfEmpty(Pg& pg){
+		if(pg.nSlot()!=0||pg.pid==curPid)return;
+		pg.wipe();
+		freePgs[pg.pid]=false;
+	}
+	
+	// new records go into pid from now on (0 = the lowest free page). the
+	// old current page was kept off the free list even once it emptied,
+	// it goes on now. wMu held
+	void setCur(uint64_t pid){
+		uint64_t old=curPid;
+		curPid=pid;
+		if(old==0||old==pid)return;
+		auto pg=loadPg(old);
+		std::unique_lock<std::shared_mutex> l(pg.latch());
+		if(!pg->bad)freeIfEmpty(*pg);
+	}
+	
+	// pack it into the current page, grab another one when that's full
+	uint64_t place(const std::string& key,const std::string& val,
+				   uint64_t lsn){
+		if(curPid!=0){
+			auto pg=loadPg(curPid);
+			std::unique_lock<std::shared_mutex> l(pg.latch());
+			int s=pg->bad?-1:pg->ins(key,val);
+			if(s>=0){
+				pg->setLsn(lsn);
+				return mkRid(curPid,s);
+			}
+		}
+		
+		auto pg=allocPg();
+		curPid=pg->pid;
+		std::unique_lock<std::shared_mutex> l(pg.latch());
+		int s=pg->ins(key,val);
+		if(s<0){
+			// fits() and okSz() rule this out. an index entry with slot
+			// -1 would lose the key for good, so don't go on
+			std::cerr<<"Record for key '"<<key<<"' doesn't fit an empty page"<<std::endl;
+			exit(EXIT_FAILURE);
+		}
+		pg->setLsn(lsn);
+		return mkRid(curPid,s);
+	}
+	
+	void setRid(const std::string& key,uint64_t rid){
+		std::unique_lock<std::shared_mutex> t(tMu);
+		idx.insert(key,rid);
+	}
+	
+	void dropRid(const std::string& key){
+		std::unique_lock<std::shared_mutex> t(tMu);
+		idx.remove(key);
+	}
+	
+	// every write gets logged through here, under wMu. the first one
+	// after a checkpoint marks index.dat stale: redo goes by key, and an
+	// index that doesn't know where records moved since can point it at
+	// a slot some other key took over. after a crash from there on the
+	// index gets rebuilt from the pages instead
+	uint64_t logTx(const std::vector<JMan::JOp>& ops){
+		if(idxSaved){
+			BTree::markStale(opt.iFile);
+			idxSaved=false;
+		}
+		return jrnl.logTx(ops);
+	}
+	
+	// live record id for a key, 0 if there isn't one (or it sits on a
+	// page that failed its checks, those are never changed).
+	// writers only (wMu), nobody else changes the tree or the pages
+	uint64_t find(const std::string& key){
+		return liveRid(idx.search(key));
+	}
+	
+	// rid if it's a live record on a sane page, 0 otherwise
+	uint64_t liveRid(uint64_t rid){
+		if(rid==0)return 0;
+		auto pg=loadPg(ridPg(rid));
+		if(pg->bad||!pg->live(ridSl(rid)))return 0;
+		return rid;
+	}
+	
+	// the actual changes, done after the journal has them
+	// (redo goes through here too). readers don't wait for these, so
+	// the order is picked to never show them a key that's half moved:
+	// new copy, then index, then drop the old copy
+	void doIns(const std::string& key,const std::string& val,uint64_t lsn){
+		Rec rec(key,val);
+		setRid(rec.key,place(rec.key,rec.val,lsn));
+	}
+	
+	void doUpd(uint64_t rid,const std::string& key,const std::string& val,
+			   uint64_t lsn){
+		auto pg=loadPg(ridPg(rid));
+		std::string v=val.substr(0,CFG::V_SZ-1);
+		{
+			std::unique_lock<std::shared_mutex> l(pg.latch());
+			if(pg->upd(ridSl(rid),v)){
+				pg->setLsn(lsn);
+				return;
+			}
+		}
+		
+		// outgrew its page, move it somewhere else
+		move(pg,rid,key,v,lsn);
+	}
+	
+	// record rid (on pg) to a new home: new copy, index, old copy goes
+	void move(BPool::Ref& pg,uint64_t rid,const std::string& key,
+			  const std::string& val,uint64_t lsn){
+		setRid(key,place(key,val,lsn));
+		std::unique_lock<std::shared_mutex> l(pg.latch());
+		pg->del(ridSl(rid));
+		pg->setLsn(lsn);
+		freeIfEmpty(*pg);
+	}
+	
+	void doDel(uint64_t rid,const std::string& key,uint64_t lsn){
+		dropRid(key);
+		auto pg=loadPg(ridPg(rid));
+		std::unique_lock<std::shared_mutex> l(pg.latch());
+		pg->del(ridSl(rid));
+		pg->setLsn(lsn);
+		freeIfEmpty(*pg);
+	}
+	
+	// redo pass over journal.log, every entry is applied as
+	// "make it look like this" so replaying twice is harmless.
+	// if the key's page already has a newer lsn the entry is skipped
+	void recover(){
+		size_t n=jrnl.redo([this](uint64_t lsn,JMan::Op op,
+								   const std::string& key,
+								   const std::string& val){
+			uint64_t rid=find(key);
+			if(rid!=0&&loadPg(ridPg(rid))->lsn()>=lsn){
+				return;
+			}
+			if(op==JMan::DEL){
+				if(rid!=0)doDel(rid,key,lsn);
+			}else if(rid!=0){
+				doUpd(rid,key,val,lsn);
+			}else{
+				doIns(key,val,lsn);
+			}
+		});
+		
+		if(n==0){
+			jrnl.trunc();
+			return;
+		}
+		std::cout<<"Replayed "<<n<<" journal entries from "
+				 <<opt.jFile<<std::endl;
+		flushAll();
+	}
+	
+	// recovery mode: no usable index.dat, so scan database.dat in parallel
+	// and bulk load the tree from the live records. empty pages found on
+	// the way make up a new free list. pages that fail their checks (torn
+	// writes) are skipped, redo puts back whatever the journal has of them
+	void rebuild(){
+		auto t1=std::chrono::steady_clock::now();
+		
+		size_t nThr=std::max(1u,std::thread::hardware_concurrency());
+		uint64_t nPgs=nextPid-1;
+		nThr=std::min<uint64_t>(nThr,(nPgs+63)/64);
+		
+		// key, page lsn, rid
+		typedef std::vector<std::tuple<std::string,uint64_t,uint64_t>> Run;
+		std::vector<Run> runs(nThr);
+		std::vector<std::vector<std::pair<uint64_t,bool>>> empty(nThr); // pid, needs a wipe
+		std::vector<size_t> bad(nThr,0);
+		std::vector<std::thread> thrs;
+		
+		for(size_t t=0;t<nThr;++t){
+			uint64_t lo=1+nPgs*t/nThr;
+			uint64_t hi=1+nPgs*(t+1)/nThr;
+			thrs.emplace_back([this,lo,hi,&runs,&empty,&bad,t](){
+				// own stream per thread, big reads
+				std::ifstream f(opt.dFile,std::ios::binary);
+				const uint64_t CHUNK=256;
+				const size_t psz=opt.pgSz;
+				std::vector<char> buf(CHUNK*psz);
+				Pg pg(0,psz);
+				Run& run=runs[t];
+				
+				for(uint64_t pid=lo;pid<hi;pid+=CHUNK){
+					uint64_t n=std::min(CHUNK,hi-pid);
+					f.seekg(pid*psz);
+					f.read(buf.data(),n*psz);
+					n=f.gcount()/psz;
+					f.clear();
+					
+					for(uint64_t i=0;i<n;++i){
+						memcpy(pg.data,&buf[i*psz],psz);
+						pg.pid=pid+i;
+						pg.init();
+						if(!pg.sane()){
+							bad[t]++;
+							continue;
+						}
+						auto recs=pg.recs();
+						if(recs.empty())empty[t].emplace_back(pg.pid,pg.nSlot()!=0);
+						for(const auto& rec:recs){
+							run.emplace_back(rec.key,pg.lsn(),
+											 mkRid(rec.pid,rec.slot));
+						}
+					}
+				}
+				std::sort(run.begin(),run.end());
+			});
+		}
+		for(auto& th:thrs)th.join();
+		
+		// merge the sorted runs pairwise
+		while(runs.size()>1){
+			std::vector<Run> next;
+			for(size_t i=0;i+1<runs.size();i+=2){
+				Run m;
+				m.reserve(runs[i].size()+runs[i+1].size());
+				std::merge(runs[i].begin(),runs[i].end(),
+						   runs[i+1].begin(),runs[i+1].end(),
+						   std::back_inserter(m));
+				next.push_back(std::move(m));
+			}
+			if(runs.size()%2)next.push_back(std::move(runs.back()));
+			runs.swap(next);
+		}
+		
+		Run all;
+		if(!runs.empty())all.swap(runs[0]);
+		
+		// a crash mid-move can leave a key in two places. the page the
+		// old copy sits on never got the delete, so its lsn is older
+		std::vector<std::pair<std::string,uint64_t>> uniq;
+		uniq.reserve(all.size());
+		uint64_t maxLsn=0;
+		for(auto& kv:all){
+			maxLsn=std::max(maxLsn,std::get<1>(kv));
+			if(!uniq.empty()&&uniq.back().first==std::get<0>(kv)){
+				uniq.back().second=std::get<2>(kv);
+			}else{
+				uniq.emplace_back(std::move(std::get<0>(kv)),std::get<2>(kv));
+			}
+		}
+		
+		idx.bulkLoad(uniq);
+		jrnl.bump(maxLsn);
+		
+		// pages that are already blank (or punched out) stay untouched
+		freePgs.clear();
+		for(auto& e:empty){
+			for(auto& pw:e){
+				if(pw.first==curPid)continue;
+				if(pw.second){
+					auto pg=loadPg(pw.first);
+					std::unique_lock<std::shared_mutex> l(pg.latch());
+					pg->wipe();
+				}
+				freePgs[pw.first]=false;
+			}
+		}
+		
+		auto t2=std::chrono::steady_clock::now();
+		std::cout<<"Index rebuilt from "<<opt.dFile<<": "<<uniq.size()
+				 <<" keys, "<<nPgs<<" pages, "<<freePgs.size()<<" free, "<<nThr<<" threads, "
+				 <<std::chrono::duration_cast<std::chrono::milliseconds>(t2-t1).count()
+				 <<" ms"<<std::endl;
+		size_t nBad=std::accumulate(bad.begin(),bad.end(),size_t(0));
+		if(nBad>0){
+			std::cerr<<"Skipped "<<nBad<<" damaged pages in "<<opt.dFile<<std::endl;
+		}
+	}
+	
+	// vacuum rate limit: n more pages of work, then sleep until we're back
+	// under opt.vacRate pages a second. false once we're shutting down
+	bool pace(std::chrono::steady_clock::time_point t0,double& used,double n){
+		used+=n;
+		auto due=opt.vacRate==0?std::chrono::steady_clock::now():
+			t0+std::chrono::microseconds((uint64_t)(used*1e6/opt.vacRate));
+		std::unique_lock<std::mutex> lk(flMu);
+		return !flCv.wait_until(lk,due,[this](){return flStop;});
+	}
+	
+	// move every record off pid so it goes on the free list. they get
+	// packed into the first page of dsts[at..] (sparse pages in pid order
+	// that the vacuum fills up) with room for all of them, or else the
+	// lowest free page, never into anything past pid. one journal
+	// transaction of UPDs with the same values, so redo just rewrites them
+	// in place. copies the index doesn't point at (left by a crash
+	// mid-move) are dropped. any = move it out however full it is.
+	// true if the page ended up free
+	bool vacPg(uint64_t pid,const std::vector<uint64_t>& dsts,size_t& at,bool any){
+		std::lock_guard<std::mutex> w(wMu);
+		if(pid>=nextPid)return false;
+		
+		auto pg=loadPg(pid);
+		std::vector<Rec> recs;
+		{
+			std::shared_lock<std::shared_mutex> l(pg.latch());
+			if(pg->bad)return false;
+			if(freePgs.count(pid)){
+				if(pg->nSlot()==0)return false;
+				freePgs.erase(pid); // the list was wrong about it
+			}
+			if(!any&&(pg->sz-pg->freeSp())*100>pg->sz*opt.vacPct){
+				return false; // filled up since
+			}
+			recs=pg->recs();
+		}
+		
+		std::vector<JMan::JOp> ops;
+		std::vector<uint16_t> slots; // slot of ops[j]
+		std::vector<uint16_t> stray;
+		size_t need=0;
+		for(auto& r:recs){
+			if(idx.search(r.key)==mkRid(pid,r.slot)){
+				ops.push_back({JMan::UPD,r.key,r.val});
+				slots.push_back(r.slot);
+				need+=Pg::cellSz(r.key,r.val)+Pg::SLOT;
+			}else{
+				stray.push_back(r.slot);
+			}
+		}
+		
+		// 0 = place() takes the lowest free page
+		uint64_t dst=0;
+		for(;!ops.empty()&&at<dsts.size()&&dsts[at]<pid;++at){
+			if(freePgs.count(dsts[at]))continue;
+			auto dp=loadPg(dsts[at]);
+			std::shared_lock<std::shared_mutex> l(dp.latch());
+			if(!dp->bad&&dp->nSlot()!=0&&dp->freeSp()>=need){
+				dst=dsts[at];
+				break;
+			}
+		}
+		if(dst==0&&!ops.empty()&&(freePgs.empty()||freePgs.begin()->first>=pid)){
+			return false; // nowhere lower to go
+		}
+		if(!ops.empty()||pid==curPid)setCur(dst);
+		
+		if(!ops.empty()){
+			uint64_t lsn=logTx(ops);
+			uint64_t first=lsn-ops.size();
+			for(size_t j=0;j<ops.size();++j){
+				move(pg,mkRid(pid,slots[j]),ops[j].key,ops[j].val,first+j);
+			}
+		}
+		
+		std::unique_lock<std::shared_mutex> l(pg.latch());
+		for(uint16_t s:stray)pg->del(s);
+		freeIfEmpty(*pg);
+		return pg->nSlot()==0;
+	}
+	
+	// a page on the free list really is empty. the list gets taken off
+	// it if not, the bytes of a page that still has records must never be
+	// cut off or punched out. wMu held, so it stays that way until the
+	// caller is done with it
+	bool isFree(uint64_t pid){
+		bool ok;
+		{
+			auto pg=loadPg(pid);
+			std::shared_lock<std::shared_mutex> l(pg.latch());
+			ok=!pg->bad&&pg->nSlot()==0;
+		}
+		if(!ok)freePgs.erase(pid);
+		return ok;
+	}
+	
+	// give the space of free pages back to the file system. free pages at
+	// the end come off with ftruncate, the rest get their blocks punched
+	// out (a hole reads back as zeros, which is an empty page). either way
+	// the journal has to be durable first, the old bytes were its to redo
+	void shrink(std::chrono::steady_clock::time_point t0,double& used){
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			setCur(0); // the next write picks the lowest free page
+			uint64_t end=nextPid;
+			while(end>1&&end-1!=curPid&&freePgs.count(end-1)&&isFree(end-1))--end;
+			if(end<nextPid){
+				jrnl.sync(jrnl.last());
+				// dropped and cut off under one ioMu, a checkpoint mustn't
+				// find them gone from the pool but still in the file
+				std::lock_guard<std::mutex> io(ioMu);
+				uint64_t to=nextPid;
+				while(to>end&&bp.drop(to-1))--to;
+				if(to<nextPid){
+					if(ftruncate(dFd,to*opt.pgSz)!=0){
+						perror("Data file truncate failed");
+						exit(EXIT_FAILURE);
+					}
+					for(uint64_t p=to;p<nextPid;++p)freePgs.erase(p);
+					nextPid=to;
+				}
+			}
+		}
+		
+#ifdef FALLOC_FL_PUNCH_HOLE
+		// a run of neighbours at a time, wMu let go in between
+		uint64_t from=1;
+		while(canPunch){
+			std::vector<uint64_t> run;
+			{
+				std::lock_guard<std::mutex> w(wMu);
+				for(auto it=freePgs.lower_bound(from);it!=freePgs.end();){
+					uint64_t pid=it->first;
+					bool punched=it->second;
+					++it; // isFree() can take pid off the list
+					if(punched||pid==curPid){
+						if(!run.empty())break;
+						continue;
+					}
+					if(!run.empty()&&(run.back()+1!=pid||run.size()>=64))break;
+					if(isFree(pid))run.push_back(pid);
+				}
+				if(run.empty())break;
+				from=run.back()+1;
+				
+				jrnl.sync(jrnl.last());
+				{
+					std::lock_guard<std::mutex> io(ioMu);
+					if(fallocate(dFd,FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+								 run[0]*opt.pgSz,run.size()*opt.pgSz)!=0){
+						canPunch=false; // file system can't, truncating still works
+						break;
+					}
+				}
+				// a copy still in the pool would fill the hole again
+				for(uint64_t pid:run){
+					if(bp.drop(pid))freePgs[pid]=true;
+				}
+			}
+			if(!pace(t0,used,1))break;
+		}
+#endif
+	}
+	
+	void vacuumer(){
+		std::unique_lock<std::mutex> lk(flMu);
+		while(!flStop){
+			flCv.wait_for(lk,std::chrono::seconds(opt.vacS));
+			if(flStop)break;
+			lk.unlock();
+			vacuum();
+			lk.lock();
+		}
+	}
+	
+public:
+	// range cursor from scan(), next() walks up, prev() walks down.
+	// holds no locks between calls: it keeps about a leaf of (key, rid)
+	// and re-seeks past the last key it handed out when that runs dry, so
+	// splits under it don't matter. values are read from the pages as it
+	// goes. switching direction carries on from the last key handed out
+	class Cursor{
+		SEng* db;
+		std::string lo;   // [lo, hi), hi empty = no end
+		std::string hi;
+		size_t left;
+		std::string last; // the next refill seeks from here
+		bool incl;        // last itself still counts
+		bool top;         // going down from the very end, last unused
+		bool rev;
+		bool fresh;       // nothing handed out or sought yet
+		bool done;        // the tree had nothing past buf
+		std::vector<std::pair<std::string,uint64_t>> buf;
+		size_t at;
+		
+		bool fill(){
+			if(done)return false;
+			{
+				std::shared_lock<std::shared_mutex> t(db->tMu);
+				if(rev)buf=db->idx.rangeRev(last,incl,top,lo,CFG::B_ORD);
+				else buf=db->idx.range(last,incl,hi,CFG::B_ORD);
+			}
+			at=0;
+			incl=top=false;
+			done=buf.size()<CFG::B_ORD;
+			return !buf.empty();
+		}
+		
+		bool step(bool down,std::string& key,std::string& val){
+			fresh=false;
+			if(down!=rev){
+				rev=down;
+				buf.clear();
+				at=0;
+				done=false;
+				incl=false;
+			}
+			
+			while(left>0){
+				if(at==buf.size()&&!fill())return false;
+				
+				const auto& e=buf[at++];
+				last=e.first;
+				val.clear();
+				bool ok;
+				{
+					auto pg=db->loadPg(ridPg(e.second));
+					std::shared_lock<std::shared_mutex> l(pg.latch());
+					ok=pg->valTo(ridSl(e.second),e.first,val);
+				}
+				if(!ok)ok=db->getTo(e.first,val); // moved since we looked
+				if(!ok)continue;                   // gone since we looked
+				
+				key=e.first;
+				left--;
+				return true;
+			}
+			return false;
+		}
+		
+	public:
+		Cursor(SEng* e,const std::string& from,const std::string& to,size_t limit)
+			:db(e),lo(from),hi(to),left(limit),last(from),incl(true),top(false),
+			 rev(false),fresh(true),done(false),at(0){}
+		
+		// false when the range (or the limit) is used up
+		bool next(std::string& key,std::string& val){
+			return step(false,key,val);
+		}
+		
+		// same going down, starts at the top of the range unless
+		// seekForPrev() said otherwise
+		bool prev(std::string& key,std::string& val){
+			if(fresh){
+				rev=true;
+				top=hi.empty();
+				last=hi;
+				incl=false;
+			}
+			return step(true,key,val);
+		}
+		
+		// the next prev() gives the last key <= key
+		void seekForPrev(const std::string& key){
+			fresh=false;
+			rev=true;
+			buf.clear();
+			at=0;
+			done=false;
+			top=false;
+			if(!hi.empty()&&key>=hi){
+				last=hi;
+				incl=false;
+			}else{
+				last=key;
+				incl=true;
+			}
+		}
+	};
+	
+	SEng(const Opts& o=Opts())
+		:opt(o),jrnl(o.jFile,o.fsync),nextPid(1),curPid(0),canPunch(true),
+		 idxSaved(false),flStop(false){
+		dFd=open(opt.dFile.c_str(),O_RDWR|O_CREAT,0644);
+		if(dFd<0){
+			perror("Can't open data file");
+			exit(EXIT_FAILURE);
+		}
+		
+		if(!Pg::okSz(opt.pgSz)){
+			std::cerr<<"Bad page size "<<opt.pgSz<<", using "
+					 <<CFG::P_SZ<<std::endl;
+			opt.pgSz=CFG::P_SZ;
+		}
+		
+		// page 0 is the file header: magic(8) page size(8)
+		// an existing file keeps the page size it was made with. one
+		// without the header wasn't made by us (or not in this format),
+		// guessing at its layout would only read garbage and then write
+		// over it, so it's left alone
+		size_t fSz=fileSz();
+		char h[16]={0};
+		if(fSz>=16&&pread(dFd,h,16,0)!=16){
+			memset(h,0,16);
+		}
+		if(get64(h)==D_MAGIC&&Pg::okSz(get64(h+8))){
+			opt.pgSz=get64(h+8);
+		}else if(fSz>0){
+			std::cerr<<opt.dFile<<" has no valid header, not opening it"<<std::endl;
+			exit(EXIT_FAILURE);
+		}else{
+			std::string hdr;
+			put64(hdr,D_MAGIC);
+			put64(hdr,opt.pgSz);
+			hdr.resize(opt.pgSz,'\0');
+			wrAt(hdr.data(),hdr.size(),0);
+			fSz=hdr.size();
+		}
+		
+		bp.setup(opt.cacheB/opt.pgSz,opt.pgSz,opt.huge);
+		bp.setIO([this](Pg& pg){readPg(pg);},
+				 [this](Pg& pg){flushPg(pg);});
+		
+		// the last page is fSz/pgSz-1
+		nextPid=std::max<uint64_t>(1,fSz/opt.pgSz);
+		if(nextPid>1)curPid=nextPid-1;
+		
+		std::string aux;
+		if(idx.load(opt.iFile,nextPid,&aux)){
+			for(size_t i=0;i+8<=aux.size();i+=8){
+				freePgs[get64(&aux[i])]=false;
+			}
+			idxSaved=true;
+		}else if(nextPid>1){
+			rebuild();
+		}
+		// new records go into curPid, it can't be on the list too (the
+		// vacuum would cut it off under them)
+		freePgs.erase(curPid);
+		recover();
+		if(!idxSaved)BTree::markStale(opt.iFile);
+		
+		flThr=std::thread([this](){flusher();});
+		if(opt.vacS>0){
+			vacThr=std::thread([this](){vacuumer();});
+		}
+	}
+	
+	~SEng(){
+		{
+			std::lock_guard<std::mutex> lk(flMu);
+			flStop=true;
+		}
+		flCv.notify_all();
+		flThr.join();
+		if(vacThr.joinable())vacThr.join();
+		
+		flushAll();
+		close(dFd);
+	}
+	
+	// the most a record can hold. longer keys or values get turned away
+	// (the index keeps the key whole, a cut one would never be found)
+	static bool fits(const std::string& key,const std::string& val=""){
+		return key.size()<CFG::K_SZ&&val.size()<CFG::V_SZ;
+	}
+	
+	// writers log + apply under wMu, then wait for the fsync without it
+	// so the next writer can go meanwhile (early lock release). a reader
+	// can see a change a moment before it's durable, it just can't get
+	// acked to the writer before then.
+	// with lsn set they don't wait at all and hand back the commit lsn,
+	// the change is durable once sync(that lsn) returns. lets a batch of
+	// writes pay for one fsync
+	bool insert(const std::string& key,const std::string& val,
+				uint64_t* lsnOut=nullptr){
+		if(!fits(key,val))return false;
+		uint64_t lsn;
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			// check if it's already there
+			if(idx.search(key)!=0){
+				return false;
+			}
+			
+			lsn=logTx({{JMan::INS,key,val}});
+			doIns(key,val,lsn);
+		}
+		if(lsnOut)*lsnOut=lsn;
+		else jrnl.sync(lsn);
+		return true;
+	}
+	
+	std::pair<bool,std::string> get(const std::string& key){
+		std::string val;
+		if(!getTo(key,val)){
+			return {false,""};
+		}
+		return {true,val};
+	}
+	
+	// get() that appends the value to out straight from the page.
+	// no wMu here: a record can move or go away between the index lookup
+	// and the page read, so check the slot still holds our key and look
+	// again if the index changed under us
+	bool getTo(const std::string& key,std::string& out){
+		uint64_t last=0;
+		while(true){
+			uint64_t rid;
+			{
+				std::shared_lock<std::shared_mutex> t(tMu);
+				rid=idx.search(key);
+			}
+			if(rid==0||rid==last){
+				return false;
+			}
+			
+			auto pg=loadPg(ridPg(rid));
+			{
+				std::shared_lock<std::shared_mutex> l(pg.latch());
+				if(pg->valTo(ridSl(rid),key,out))return true;
+			}
+			last=rid;
+		}
+	}
+	
+	bool update(const std::string& key,const std::string& newVal,
+				uint64_t* lsnOut=nullptr){
+		if(!fits(key,newVal))return false;
+		uint64_t lsn;
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			uint64_t rid=find(key);
+			if(rid==0){
+				return false;
+			}
+			
+			lsn=logTx({{JMan::UPD,key,newVal}});
+			doUpd(rid,key,newVal,lsn);
+		}
+		if(lsnOut)*lsnOut=lsn;
+		else jrnl.sync(lsn);
+		return true;
+	}
+	
+	bool remove(const std::string& key,uint64_t* lsnOut=nullptr){
+		uint64_t lsn;
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			uint64_t rid=find(key);
+			if(rid==0){
+				return false;
+			}
+			
+			lsn=logTx({{JMan::DEL,key,""}});
+			doDel(rid,key,lsn);
+		}
+		if(lsnOut)*lsnOut=lsn;
+		else jrnl.sync(lsn);
+		return true;
+	}
+	
+	// get() for a bunch of keys, results line up with keys. they're
+	// looked up in sorted order so the tree is walked leaf to leaf, and
+	// every page is fetched and latched once for all its keys
+	std::vector<std::pair<bool,std::string>> multiGet(const std::vector<std::string>& keys){
+		std::vector<std::pair<bool,std::string>> res(keys.size(),{false,""});
+		std::vector<size_t> ord(keys.size());
+		std::iota(ord.begin(),ord.end(),0);
+		std::sort(ord.begin(),ord.end(),[&keys](size_t a,size_t b){
+			return keys[a]<keys[b];
+		});
+		
+		std::vector<const std::string*> sorted;
+		sorted.reserve(ord.size());
+		for(size_t i:ord)sorted.push_back(&keys[i]);
+		std::vector<uint64_t> rids;
+		{
+			std::shared_lock<std::shared_mutex> t(tMu);
+			rids=idx.searchSorted(sorted);
+		}
+		
+		// (rid, which key) in rid order, so a page's keys sit together
+		std::vector<std::pair<uint64_t,size_t>> byRid;
+		for(size_t j=0;j<ord.size();++j){
+			if(rids[j]!=0)byRid.emplace_back(rids[j],ord[j]);
+		}
+		std::sort(byRid.begin(),byRid.end());
+		
+		std::vector<size_t> moved;
+		for(size_t i=0;i<byRid.size();){
+			uint64_t pid=ridPg(byRid[i].first);
+			auto pg=loadPg(pid);
+			std::shared_lock<std::shared_mutex> l(pg.latch());
+			for(;i<byRid.size()&&ridPg(byRid[i].first)==pid;++i){
+				size_t k=byRid[i].second;
+				if(pg->valTo(ridSl(byRid[i].first),keys[k],res[k].second)){
+					res[k].first=true;
+				}else{
+					moved.push_back(k);
+				}
+			}
+		}
+		
+		// changed under us, these go the slow way
+		for(size_t k:moved){
+			res[k].first=getTo(keys[k],res[k].second);
+		}
+		return res;
+	}
+	
+	// insert-or-update a bunch of pairs as one journal transaction: one
+	// commit record, one fsync. the last pair wins if a key repeats.
+	// lsnOut works like it does for insert(). false (and nothing written)
+	// if any pair is too long
+	bool writeBatch(const std::vector<std::pair<std::string,std::string>>& kvs,
+					uint64_t* lsnOut=nullptr){
+		for(const auto& kv:kvs){
+			if(!fits(kv.first,kv.second))return false;
+		}
+		
+		// key order, so neighbours land in the same leaf and page
+		std::vector<size_t> ord(kvs.size());
+		std::iota(ord.begin(),ord.end(),0);
+		std::stable_sort(ord.begin(),ord.end(),[&kvs](size_t a,size_t b){
+			return kvs[a].first<kvs[b].first;
+		});
+		std::vector<size_t> uniq;
+		for(size_t i:ord){
+			if(!uniq.empty()&&kvs[uniq.back()].first==kvs[i].first){
+				uniq.back()=i;
+			}else{
+				uniq.push_back(i);
+			}
+		}
+		if(uniq.empty())return true;
+		
+		std::vector<const std::string*> keys;
+		keys.reserve(uniq.size());
+		for(size_t i:uniq)keys.push_back(&kvs[i].first);
+		
+		uint64_t lsn;
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			// sorted, so one descent per leaf run instead of one per key
+			std::vector<uint64_t> rids=idx.searchSorted(keys);
+			std::vector<JMan::JOp> ops;
+			ops.reserve(uniq.size());
+			for(size_t j=0;j<uniq.size();++j){
+				rids[j]=liveRid(rids[j]);
+				ops.push_back({rids[j]?JMan::UPD:JMan::INS,kvs[uniq[j]].first,kvs[uniq[j]].second});
+			}
+			
+			// op j was logged as lsn-n+j. pages take the lsn of the op
+			// that touched them, so redo can tell which ops a page has.
+			// same order as one at a time (new copies, index, old copies
+			// go), only the index part is done once for the whole batch
+			lsn=logTx(ops);
+			uint64_t first=lsn-ops.size();
+			std::vector<std::pair<const std::string*,uint64_t>> newRids;
+			std::vector<size_t> moved;
+			for(size_t j=0;j<ops.size();++j){
+				if(rids[j]!=0){
+					auto pg=loadPg(ridPg(rids[j]));
+					std::unique_lock<std::shared_mutex> l(pg.latch());
+					if(pg->upd(ridSl(rids[j]),ops[j].val)){
+						pg->setLsn(first+j);
+						continue;
+					}
+					moved.push_back(j); // outgrew its page
+				}
+				newRids.emplace_back(&ops[j].key,place(ops[j].key,ops[j].val,first+j));
+			}
+			if(!newRids.empty()){
+				std::unique_lock<std::shared_mutex> t(tMu);
+				idx.insertSorted(newRids);
+			}
+			for(size_t j:moved){
+				auto pg=loadPg(ridPg(rids[j]));
+				std::unique_lock<std::shared_mutex> l(pg.latch());
+				pg->del(ridSl(rids[j]));
+				pg->setLsn(std::max(pg->lsn(),first+j)); // a later op may have been here
+				freeIfEmpty(*pg);
+			}
+		}
+		if(lsnOut)*lsnOut=lsn;
+		else jrnl.sync(lsn);
+		return true;
+	}
+	
+	// keys in [start, end), at most limit of them. an empty end means no
+	// upper bound. next() for ascending, prev() for descending
+	Cursor scan(const std::string& start,const std::string& end,size_t limit){
+		return Cursor(this,start,end,limit);
+	}
+	
+	// smallest key that's bigger than everything starting with prefix,
+	// "" if there's none (all 0xff)
+	static std::string prefixEnd(std::string prefix){
+		while(!prefix.empty()&&(unsigned char)prefix.back()==0xFF){
+			prefix.pop_back();
+		}
+		if(!prefix.empty())prefix.back()++;
+		return prefix;
+	}
+	
+	// keys starting with prefix in order, at most limit. one seek to the
+	// prefix, then the leaf walk stops at the first key past it
+	std::vector<std::string> prefixScan(const std::string& prefix,size_t limit){
+		std::vector<std::pair<std::string,uint64_t>> hits;
+		{
+			std::shared_lock<std::shared_mutex> t(tMu);
+			hits=idx.range(prefix,true,prefixEnd(prefix),limit);
+		}
+		std::vector<std::string> keys;
+		keys.reserve(hits.size());
+		for(auto& h:hits)keys.push_back(std::move(h.first));
+		return keys;
+	}
+	
+	// key walk for cursors: the first n keys after after (from the very
+	// first one if first). one seek, so a whole walk is O(n log n)
+	std::vector<std::string> keysAfter(const std::string& after,bool first,size_t n){
+		std::vector<std::pair<std::string,uint64_t>> hits;
+		{
+			std::shared_lock<std::shared_mutex> t(tMu);
+			hits=idx.range(after,first,"",n);
+		}
+		std::vector<std::string> keys;
+		keys.reserve(hits.size());
+		for(auto& h:hits)keys.push_back(std::move(h.first));
+		return keys;
+	}
+	
+	// wait until every write up to lsn is durable
+	void sync(uint64_t lsn){
+		jrnl.sync(lsn);
+	}
+	
+	// checkpoint: everything to disk, then the journal can go
+	void flushAll(){
+		std::lock_guard<std::mutex> w(wMu);
+		writeBack(); // nothing changes under wMu, so that's every dirty page
+		if(opt.fsync&&fdatasync(dFd)!=0){
+			perror("Data file sync failed");
+			exit(EXIT_FAILURE);
+		}
+		std::string aux;
+		for(auto& f:freePgs)put64(aux,f.first);
+		idx.save(opt.iFile,nextPid,aux,opt.fsync);
+		idxSaved=true;
+		jrnl.trunc();
+	}
+	
+	// online vacuum pass, runs on its own every opt.vacS seconds. looks
+	// over the file for pages under opt.vacPct full, moves the records of
+	// the high ones into the low ones (so the end of the file empties out)
+	// and hands the freed space back. writers only wait for one page at a
+	// time and the whole thing is paced to opt.vacRate pages a second.
+	// returns how many pages it emptied
+	size_t vacuum(){
+		auto t0=std::chrono::steady_clock::now();
+		double used=0;
+		
+		// what's on disk is only a hint, vacPg looks at the real page
+		uint64_t end;
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			end=nextPid;
+		}
+		const uint64_t CHUNK=256;
+		const size_t psz=opt.pgSz;
+		std::vector<char> buf(CHUNK*psz);
+		std::vector<uint16_t> use(end,0); // bytes in use, 0 = empty page
+		Pg pg(0,psz);
+		for(uint64_t pid=1;pid<end;pid+=CHUNK){
+			ssize_t got=pread(dFd,buf.data(),std::min(CHUNK,end-pid)*psz,pid*psz);
+			if(got<=0)break;
+			for(uint64_t i=0;i<(uint64_t)got/psz;++i){
+				memcpy(pg.data,&buf[i*psz],psz);
+				pg.init();
+				if(!pg.sane()){
+					use[pid+i]=psz; // leave it alone
+					continue;
+				}
+				size_t fr=pg.freeSp();
+				if(pg.nSlot()!=0&&fr<psz)use[pid+i]=psz-fr;
+			}
+			if(!pace(t0,used,got/psz/16.0))return 0; // reads are cheap
+		}
+		auto sparse=[&](uint64_t p){
+			return use[p]*100<=psz*opt.vacPct;
+		};
+		
+		// cut: everything from there up gets moved down, as far as the
+		// empty and sparse pages under it have room for it (and a bit)
+		size_t room=0;
+		for(uint64_t p=1;p<end;++p){
+			if(sparse(p))room+=psz-use[p];
+		}
+		uint64_t cut=end;
+		size_t above=0;
+		while(cut>1){
+			uint64_t p=cut-1;
+			size_t r=sparse(p)?psz-use[p]:0;
+			if((above+use[p])*11/10>room-r)break;
+			above+=use[p];
+			room-=r;
+			cut=p;
+		}
+		
+		std::vector<uint64_t> src;
+		std::vector<uint64_t> dst;
+		for(uint64_t p=1;p<end;++p){
+			if(use[p]==0)continue;
+			if(p>=cut||sparse(p))src.push_back(p);
+			if(p<cut&&sparse(p))dst.push_back(p);
+		}
+		
+		// empty them from the top, fill them from the bottom, stop where
+		// the two meet
+		size_t n=0;
+		size_t at=0;
+		for(size_t i=src.size();i-->0;){
+			if(at<dst.size()&&src[i]<=dst[at])break;
+			if(vacPg(src[i],dst,at,src[i]>=cut))n++;
+			if(!pace(t0,used,1))return n;
+		}
+		shrink(t0,used);
+		return n;
+	}
+	
+	// slow way for benchmark, only sees what has reached the file
+	std::pair<bool,std::string> lSearch(const std::string& key){
+		size_t numPgs=fileSz()/opt.pgSz;
+		
+		Pg pg(0,opt.pgSz);
+		for(uint64_t pid=1;pid<numPgs;++pid){
+			pg.pid=pid;
+			readPg(pg);
+			
+			for(const auto& rec:pg.recs()){
+				if(rec.key==key){
+					return {true,rec.getV()};
+				}
+			}
+		}
+		return {false,""};
+	}
+	
+	void stats(){
+		size_t fSz=fileSz();
+		size_t numPgs=fSz/opt.pgSz;
+		
+		std::cout<<"=== Database Statistics ==="<<std::endl;
+		std::cout<<"File size: "<<fSz<<" bytes"<<std::endl;
+		std::cout<<"Number of pages: "<<numPgs<<std::endl;
+		std::cout<<"Page size: "<<opt.pgSz<<" bytes"<<std::endl;
+		std::cout<<"Cache size: "<<bp.capacity()<<" pages"<<std::endl;
+		{
+			std::lock_guard<std::mutex> w(wMu);
+			std::cout<<"Free pages: "<<freePgs.size()<<std::endl;
+		}
+		std::shared_lock<std::shared_mutex> t(tMu);
+		std::cout<<"Index depth: "<<idx.depth()<<std::endl;
 	}
 };
 
@@ -544,122 +3445,833 @@ public:
 // part 2: the server part
 // ==========================================
 
-// mutex so threads don't fight
-std::mutex db_mutex;
-
+// one epoll loop per core, each with its own SO_REUSEPORT listener so the
+// kernel spreads new connections. sockets are non-blocking + edge triggered,
+// every connection keeps its own in/out buffers. requests are lines ending
+// in '\n', thread count never depends on how many clients there are.
+// loops never wait on the journal: a batch with writes in it parks its
+// replies until the syncer thread has made its lsn durable, and the
+// syncer pokes every loop's eventfd each time durLsn moves
 class DBServer {
-    int server_fd;
+    // the first byte a client sends picks the protocol for the connection
+    enum Mode { UNKNOWN, TEXT, BINARY, RESP };
+
+    struct Conn {
+        int fd;
+        Mode mode;
+        std::string in;   // bytes read but not a whole request yet
+        std::string out;  // replies not sent yet
+        size_t out_off;
+        bool eof;         // they're done sending, close once out is gone
+        // replies waiting for their lsn to be durable, in order. anything
+        // after a held one waits too, replies never pass each other
+        std::deque<std::pair<uint64_t, std::string>> held;
+    };
+
+    static constexpr size_t MAX_LINE = 1 << 20; // drop clients that never send '\n'
+    static constexpr size_t MAX_SCAN = 100000;  // rows per SCAN reply
+    static constexpr size_t MAX_CURSORS = 1 << 16; // SCAN walks remembered
+
+    // binary frames, little endian like the files:
+    //   request  = magic(1) op(1) id(4) klen(2) vlen(4) key val
+    //   reply    = magic(1) status(1) id(4) 0(2) vlen(4) val
+    // the id is echoed back untouched so clients can match replies
+    static constexpr unsigned char BIN_MAGIC = 0xB7; // never starts a text command
+    static constexpr size_t BIN_HDR = 12;
+    enum BinOp { OP_GET = 1, OP_PUT = 2, OP_DEL = 3 };
+    enum BinStatus { ST_OK = 0, ST_NOT_FOUND = 1, ST_ERR = 2 };
+
+    // RESP2 (redis) is picked by a leading '*', requests are arrays of bulk strings
+    static constexpr size_t RESP_MAX_ARGS = 1 << 16;
+
     SEng& db; // pointer to the boss
+    int port;
+    std::vector<int> listeners; // one per loop
+    std::vector<int> wakers;    // eventfd per loop, poked when durLsn moves
     bool running;
 
-public:
-    DBServer(SEng& engine, int port) : db(engine), running(true) {
+    std::mutex sync_mu;
+    std::condition_variable sync_cv;
+    uint64_t want_lsn = 0;            // highest lsn a loop is waiting on
+    std::atomic<uint64_t> dur_lsn{0}; // synced up to here
+
+    // SCAN cursors: clients want a decimal number, the walk wants the
+    // last key it handed out. ids only grow, the oldest get forgotten
+    std::mutex scan_mu;
+    std::unordered_map<uint64_t, std::string> scan_curs;
+    std::deque<uint64_t> scan_ids; // oldest first
+    uint64_t scan_next = 1;
+
+    // one thread does the journal syncs for every loop. whatever got
+    // asked for while it was syncing goes in the next one
+    void syncer() {
+        std::unique_lock<std::mutex> lk(sync_mu);
+        while (running) {
+            sync_cv.wait(lk, [this]() { return want_lsn > dur_lsn; });
+            uint64_t upto = want_lsn;
+            lk.unlock();
+            db.sync(upto);
+            dur_lsn = upto;
+            uint64_t one = 1;
+            for (int efd : wakers) {
+                if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("eventfd write failed");
+            }
+            lk.lock();
+        }
+    }
+
+    void want_sync(uint64_t lsn) {
+        {
+            std::lock_guard<std::mutex> lk(sync_mu);
+            if (lsn <= want_lsn) return;
+            want_lsn = lsn;
+        }
+        sync_cv.notify_one();
+    }
+
+    // move replies whose lsn is durable now over to out
+    static void release(Conn& c, uint64_t dur) {
+        while (!c.held.empty() && c.held.front().first <= dur) {
+            c.out += c.held.front().second;
+            c.held.pop_front();
+        }
+    }
+
+    static void set_nonblock(int fd) {
+        int fl = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+    }
+
+    int make_listener() {
         // make a socket
-        if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
             perror("Socket failed");
             exit(EXIT_FAILURE);
         }
 
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+            perror("SO_REUSEPORT failed");
+            exit(EXIT_FAILURE);
+        }
+
         sockaddr_in address;
+        memset(&address, 0, sizeof(address));
         address.sin_family = AF_INET;
         address.sin_addr.s_addr = INADDR_ANY;
         address.sin_port = htons(port);
 
         // bind it
-        if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
             perror("Bind failed");
             exit(EXIT_FAILURE);
         }
 
         // listen for connections
-        if (listen(server_fd, 3) < 0) {
+        if (listen(fd, SOMAXCONN) < 0) {
             perror("Listen failed");
             exit(EXIT_FAILURE);
         }
-        
-        std::cout << "Server listening on port " << port << "..." << std::endl;
+
+        set_nonblock(fd);
+        return fd;
+    }
+
+    // run one request line, the reply goes on the end of out.
+    // writes don't wait for the journal, lsn collects the highest one
+    // and the caller syncs once for the whole batch before replying
+    void handle_line(const std::string& line, std::string& out, uint64_t& lsn) {
+        std::stringstream ss(line);
+        std::string cmd, key, val;
+        ss >> cmd >> key;
+
+        // SEng does its own locking, loops don't wait on each other here
+        if (cmd == "PUT") {
+            // format: PUT key value
+            getline(ss, val);
+            if (!val.empty() && val[0] == ' ') val = val.substr(1); // trim it
+
+            uint64_t l = 0;
+            if (!SEng::fits(key, val)) out += "ERR: Key or value too long\n";
+            else if (db.insert(key, val, &l)) out += "OK: Inserted\n";
+            else if (db.update(key, val, &l)) out += "OK: Updated\n";
+            else out += "ERR: Failed\n";
+            lsn = std::max(lsn, l);
+
+        } else if (cmd == "GET") {
+            // format: GET key
+            auto result = db.get(key);
+            if (result.first) out += "OK: " + result.second + "\n";
+            else out += "ERR: Not Found\n";
+
+        } else if (cmd == "DEL") {
+            uint64_t l = 0;
+            if (db.remove(key, &l)) out += "OK: Deleted\n";
+            else out += "ERR: Not Found\n";
+            lsn = std::max(lsn, l);
+
+        } else if (cmd == "MGET") {
+            // format: MGET k1 k2 ..., one reply line per key
+            std::vector<std::string> keys;
+            for (std::string k = key; !k.empty(); k.clear(), ss >> k) keys.push_back(k);
+            for (auto& r : db.multiGet(keys)) {
+                if (r.first) out += "OK: " + r.second + "\n";
+                else out += "ERR: Not Found\n";
+            }
+
+        } else if (cmd == "SCAN") {
+            // format: SCAN start end [limit], "-" for an open end
+            // reply: "OK: n rows" then n lines of "key value"
+            std::string end;
+            size_t limit = 100;
+            ss >> end >> limit;
+            if (key.empty() || end.empty()) {
+                out += "ERR: Usage SCAN start end [limit]\n";
+                return;
+            }
+            if (key == "-") key.clear();
+            if (end == "-") end.clear();
+            limit = std::min<size_t>(limit, MAX_SCAN);
+
+            auto cur = db.scan(key, end, limit);
+            std::string rows, k, v;
+            size_t cnt = 0;
+            while (cur.next(k, v)) {
+                rows += k + " " + v + "\n";
+                cnt++;
+            }
+            out += "OK: " + std::to_string(cnt) + " rows\n";
+            out += rows;
+
+        } else if (cmd == "RSCAN") {
+            // format: RSCAN start end [limit], same as SCAN but from the top
+            // down, so the next page is "RSCAN start <last key> limit"
+            std::string end;
+            size_t limit = 100;
+            ss >> end >> limit;
+            if (key.empty() || end.empty()) {
+                out += "ERR: Usage RSCAN start end [limit]\n";
+                return;
+            }
+            if (key == "-") key.clear();
+            if (end == "-") end.clear();
+            limit = std::min<size_t>(limit, MAX_SCAN);
+
+            auto cur = db.scan(key, end, limit);
+            std::string rows, k, v;
+            size_t cnt = 0;
+            while (cur.prev(k, v)) {
+                rows += k + " " + v + "\n";
+                cnt++;
+            }
+            out += "OK: " + std::to_string(cnt) + " rows\n";
+            out += rows;
+
+        } else if (cmd == "KEYS") {
+            // format: KEYS prefix*  (any glob works, the prefix part is the fast bit)
+            // reply: "OK: n keys" then one key per line
+            if (key.empty()) {
+                out += "ERR: Usage KEYS pattern\n";
+                return;
+            }
+            auto keys = keys_matching(key);
+            out += "OK: " + std::to_string(keys.size()) + " keys\n";
+            for (const auto& k : keys) out += k + "\n";
+
+        } else if (cmd == "MPUT") {
+            // format: MPUT k1 v1 k2 v2 ... (no spaces in the values)
+            std::vector<std::pair<std::string, std::string>> kvs;
+            std::string k = key, v;
+            while (!k.empty() && (ss >> v)) {
+                kvs.emplace_back(k, v);
+                k.clear();
+                ss >> k;
+            }
+            if (kvs.empty() || !k.empty()) {
+                out += "ERR: Usage MPUT k1 v1 k2 v2 ...\n";
+            } else {
+                uint64_t l = 0;
+                if (db.writeBatch(kvs, &l)) out += "OK: " + std::to_string(kvs.size()) + " written\n";
+                else out += "ERR: Key or value too long\n";
+                lsn = std::max(lsn, l);
+            }
+        } else {
+            out += "ERR: Unknown Command\n";
+        }
+    }
+
+    // reply header, vlen gets patched once the value is in
+    static size_t bin_reply(std::string& out, BinStatus st, uint32_t id) {
+        size_t at = out.size();
+        out += (char)BIN_MAGIC;
+        out += (char)st;
+        put32(out, id);
+        put16(out, 0);
+        put32(out, 0);
+        return at;
+    }
+
+    // run one binary request, reply goes on the end of out (lsn as above)
+    void handle_bin(unsigned char op, uint32_t id, const std::string& key,
+                    const char* val, size_t vlen, std::string& out, uint64_t& lsn) {
+        if (key.size() >= CFG::K_SZ || vlen >= CFG::V_SZ) {
+            bin_reply(out, ST_ERR, id);
+            return;
+        }
+
+        if (op == OP_GET) {
+            // value goes from the page right into the send buffer
+            size_t at = bin_reply(out, ST_OK, id);
+            if (db.getTo(key, out)) {
+                uint32_t n = out.size() - at - BIN_HDR;
+                memcpy(&out[at + 8], &n, 4);
+            } else {
+                out[at + 1] = (char)ST_NOT_FOUND;
+            }
+        } else if (op == OP_PUT) {
+            std::string v(val, vlen);
+            uint64_t l = 0;
+            bool ok = db.insert(key, v, &l) || db.update(key, v, &l);
+            bin_reply(out, ok ? ST_OK : ST_ERR, id);
+            lsn = std::max(lsn, l);
+        } else if (op == OP_DEL) {
+            uint64_t l = 0;
+            bin_reply(out, db.remove(key, &l) ? ST_OK : ST_NOT_FOUND, id);
+            lsn = std::max(lsn, l);
+        } else {
+            bin_reply(out, ST_ERR, id);
+        }
+    }
+
+    // every whole frame in the buffer, a partial one waits for more bytes.
+    // false = garbage or a frame too big to ever buffer
+    bool parse_bin(Conn& c, uint64_t& lsn) {
+        size_t pos = 0;
+        while (c.in.size() - pos >= BIN_HDR) {
+            const char* h = c.in.data() + pos;
+            if ((unsigned char)h[0] != BIN_MAGIC) return false;
+            size_t klen = get16(h + 6);
+            size_t vlen = get32(h + 8);
+            if (BIN_HDR + klen + vlen > MAX_LINE) return false;
+            if (c.in.size() - pos < BIN_HDR + klen + vlen) break;
+
+            std::string key(h + BIN_HDR, klen);
+            handle_bin((unsigned char)h[1], get32(h + 2), key,
+                       h + BIN_HDR + klen, vlen, c.out, lsn);
+            pos += BIN_HDR + klen + vlen;
+        }
+        c.in.erase(0, pos);
+        return true;
+    }
+
+    // ---- RESP mode, so redis-benchmark / memtier / redis-cli can talk to us ----
+
+    static void resp_bulk(std::string& out, const std::string& v) {
+        out += '$';
+        out += std::to_string(v.size());
+        out += "\r\n";
+        out += v;
+        out += "\r\n";
+    }
+
+    static void resp_int(std::string& out, long long n) {
+        out += ':';
+        out += std::to_string(n);
+        out += "\r\n";
+    }
+
+    static void resp_arr(std::string& out, size_t n) {
+        out += '*';
+        out += std::to_string(n);
+        out += "\r\n";
+    }
+
+    // write through the engine the way PUT does
+    bool upsert(const std::string& key, const std::string& val, uint64_t& lsn) {
+        uint64_t l = 0;
+        bool ok = db.insert(key, val, &l) || db.update(key, val, &l);
+        lsn = std::max(lsn, l);
+        return ok;
+    }
+
+    // KEYS pattern: the part before the first glob char is a prefix scan,
+    // anything after it is checked with fnmatch
+    std::vector<std::string> keys_matching(const std::string& pat) {
+        size_t g = pat.find_first_of("*?[\\");
+        auto keys = db.prefixScan(pat.substr(0, g), MAX_SCAN);
+        if (g == std::string::npos) {
+            // no glob at all, only the exact key counts
+            keys.erase(std::remove_if(keys.begin(), keys.end(),
+                                      [&pat](const std::string& k) { return k != pat; }),
+                       keys.end());
+        } else if (!(g == pat.size() - 1 && pat[g] == '*')) {
+            keys.erase(std::remove_if(keys.begin(), keys.end(),
+                                      [&pat](const std::string& k) {
+                                          return fnmatch(pat.c_str(), k.c_str(), 0) != 0;
+                                      }),
+                       keys.end());
+        }
+        return keys;
+    }
+
+    void get_resp(const std::string& key, std::string& out) {
+        std::string v;
+        if (db.getTo(key, v)) resp_bulk(out, v);
+        else out += "$-1\r\n";
     }
 
-    // handle a client
-    void handle_client(int new_socket) {
-        char buffer[1024] = {0};
-        
-        while (true) {
-            memset(buffer, 0, 1024);
-            int valread = read(new_socket, buffer, 1024);
-            if (valread <= 0) break; // gone
-
-            std::string request(buffer);
-            std::stringstream ss(request);
-            std::string cmd, key, val;
-            ss >> cmd >> key;
-
-            std::string response;
-
-            // safety first
-            // lock it up so we don't crash
-            {
-                std::lock_guard<std::mutex> lock(db_mutex);
-                
-                if (cmd == "PUT") {
-                    // format: PUT key value
-                    getline(ss, val); 
-                    if (!val.empty() && val[0] == ' ') val = val.substr(1); // trim it
-                    
-                    if (db.insert(key, val)) response = "OK: Inserted\n";
-                    else if (db.update(key, val)) response = "OK: Updated\n";
-                    else response = "ERR: Failed\n";
-                    
-                } else if (cmd == "GET") {
-                    // format: GET key
-                    auto result = db.get(key);
-                    if (result.first) response = "OK: " + result.second + "\n";
-                    else response = "ERR: Not Found\n";
-                    
-                } else if (cmd == "DEL") {
-                    if (db.remove(key)) response = "OK: Deleted\n";
-                    else response = "ERR: Not Found\n";
+    // run one RESP command (args[0] is the name), lsn as in handle_line
+    void handle_resp(std::vector<std::string>& args, std::string& out, uint64_t& lsn) {
+        std::string cmd = args[0];
+        for (auto& ch : cmd) ch = toupper((unsigned char)ch);
+        size_t n = args.size();
+
+        // same limits as the binary protocol, the engine would cut them short
+        for (size_t i = 1; i < n; ++i) {
+            if (args[i].size() >= std::max(CFG::K_SZ, CFG::V_SZ)) {
+                out += "-ERR argument too long\r\n";
+                return;
+            }
+        }
+
+        if (cmd == "GET" && n == 2) {
+            get_resp(args[1], out);
+        } else if (cmd == "SET" && n >= 3) {
+            // NX / XX map onto insert / update. keys never expire here, so
+            // EX, PX and friends are turned down instead of ignored
+            bool nx = false, xx = false;
+            for (size_t i = 3; i < n; ++i) {
+                std::string opt = args[i];
+                for (auto& ch : opt) ch = toupper((unsigned char)ch);
+                if (opt == "NX") nx = true;
+                else if (opt == "XX") xx = true;
+                else if (opt == "EX" || opt == "PX" || opt == "EXAT" || opt == "PXAT" ||
+                         opt == "KEEPTTL" || opt == "GET") {
+                    out += "-ERR SET " + opt + " is not supported\r\n";
+                    return;
                 } else {
-                    response = "ERR: Unknown Command\n";
+                    out += "-ERR syntax error\r\n";
+                    return;
+                }
+            }
+            if (nx && xx) {
+                out += "-ERR syntax error\r\n";
+                return;
+            }
+            if (args[1].size() >= CFG::K_SZ || args[2].size() >= CFG::V_SZ) {
+                out += "-ERR key or value too long\r\n";
+                return;
+            }
+            uint64_t l = 0;
+            bool ok = nx ? db.insert(args[1], args[2], &l)
+                    : xx ? db.update(args[1], args[2], &l)
+                    : upsert(args[1], args[2], l);
+            lsn = std::max(lsn, l);
+            if (ok) out += "+OK\r\n";
+            else if (nx || xx) out += "$-1\r\n"; // condition not met
+            else out += "-ERR failed\r\n";
+        } else if (cmd == "DEL" && n >= 2) {
+            long long gone = 0;
+            for (size_t i = 1; i < n; ++i) {
+                uint64_t l = 0;
+                if (db.remove(args[i], &l)) gone++;
+                lsn = std::max(lsn, l);
+            }
+            resp_int(out, gone);
+        } else if (cmd == "EXISTS" && n >= 2) {
+            long long found = 0;
+            std::string scratch;
+            for (size_t i = 1; i < n; ++i) {
+                scratch.clear();
+                if (db.getTo(args[i], scratch)) found++;
+            }
+            resp_int(out, found);
+        } else if (cmd == "MGET" && n >= 2) {
+            std::vector<std::string> keys(args.begin() + 1, args.end());
+            resp_arr(out, keys.size());
+            for (auto& r : db.multiGet(keys)) {
+                if (r.first) resp_bulk(out, r.second);
+                else out += "$-1\r\n";
+            }
+        } else if (cmd == "MSET" && n >= 3 && n % 2 == 1) {
+            for (size_t i = 1; i < n; i += 2) {
+                if (args[i].size() >= CFG::K_SZ || args[i + 1].size() >= CFG::V_SZ) {
+                    out += "-ERR key or value too long\r\n";
+                    return;
                 }
-            } // unlocks auto-magically
+            }
+            std::vector<std::pair<std::string, std::string>> kvs;
+            for (size_t i = 1; i < n; i += 2) kvs.emplace_back(args[i], args[i + 1]);
+            uint64_t l = 0;
+            db.writeBatch(kvs, &l);
+            lsn = std::max(lsn, l);
+            out += "+OK\r\n";
+        } else if (cmd == "SCAN" && n >= 2) {
+            // the cursor stands for the last key handed out ("0" starts
+            // and ends a walk), so each call is one seek
+            std::string after;
+            if (args[1] != "0" && !cursor_key(args[1], after)) {
+                out += "-ERR invalid cursor\r\n";
+                return;
+            }
+            size_t count = 10;
+            std::string match;
+            for (size_t i = 2; i + 1 < n; i += 2) {
+                std::string opt = args[i];
+                for (auto& ch : opt) ch = toupper((unsigned char)ch);
+                if (opt == "COUNT") count = std::min(MAX_SCAN, std::max<size_t>(1, std::strtoull(args[i + 1].c_str(), nullptr, 10)));
+                else if (opt == "MATCH") match = args[i + 1];
+            }
+            auto keys = db.keysAfter(after, args[1] == "0", count);
+            std::string next = keys.size() < count ? "0" : std::to_string(new_cursor(keys.back()));
+
+            std::vector<const std::string*> hits;
+            for (const auto& k : keys) {
+                if (match.empty() || fnmatch(match.c_str(), k.c_str(), 0) == 0) hits.push_back(&k);
+            }
+            resp_arr(out, 2);
+            resp_bulk(out, next);
+            resp_arr(out, hits.size());
+            for (auto* k : hits) resp_bulk(out, *k);
+        } else if (cmd == "KEYS" && n == 2) {
+            auto keys = keys_matching(args[1]);
+            resp_arr(out, keys.size());
+            for (const auto& k : keys) resp_bulk(out, k);
+        } else if (cmd == "PING") {
+            if (n > 1) resp_bulk(out, args[1]);
+            else out += "+PONG\r\n";
+        } else if (cmd == "COMMAND" || cmd == "CONFIG") {
+            // benchmark tools ask at startup, an empty answer keeps them happy
+            resp_arr(out, 0);
+        } else {
+            out += "-ERR unknown command '" + args[0] + "'\r\n";
+        }
+    }
 
-            // send back
-            send(new_socket, response.c_str(), response.length(), 0);
+    uint64_t new_cursor(const std::string& key) {
+        std::lock_guard<std::mutex> lk(scan_mu);
+        if (scan_ids.size() >= MAX_CURSORS) {
+            scan_curs.erase(scan_ids.front());
+            scan_ids.pop_front();
         }
-        
-        close(new_socket);
+        uint64_t id = scan_next++;
+        scan_curs.emplace(id, key);
+        scan_ids.push_back(id);
+        return id;
     }
 
-    void start() {
+    // false for garbage and for cursors that were never handed out or got forgotten
+    bool cursor_key(const std::string& c, std::string& key) {
+        if (c.empty() || c.size() > 20) return false;
+        for (char ch : c) if (ch < '0' || ch > '9') return false;
+        std::lock_guard<std::mutex> lk(scan_mu);
+        auto it = scan_curs.find(std::strtoull(c.c_str(), nullptr, 10));
+        if (it == scan_curs.end()) return false;
+        key = it->second;
+        return true;
+    }
+
+    // one "<prefix><number>\r\n" line at pos. 0 = need more bytes, -1 = garbage
+    static long long resp_num(const std::string& in, size_t& pos, char prefix) {
+        if (pos >= in.size()) return 0;
+        if (in[pos] != prefix) return -1;
+        size_t eol = in.find("\r\n", pos);
+        if (eol == std::string::npos) return in.size() - pos > 32 ? -1 : 0;
+        long long v = 0;
+        for (size_t i = pos + 1; i < eol; ++i) {
+            if (!isdigit((unsigned char)in[i]) || v > (1LL << 40)) return -1;
+            v = v * 10 + (in[i] - '0');
+        }
+        pos = eol + 2;
+        return v + 1; // so that an empty array / string isn't "need more"
+    }
+
+    // every whole RESP array in the buffer, same rules as parse_bin
+    bool parse_resp(Conn& c, uint64_t& lsn) {
+        size_t pos = 0;
+        std::vector<std::string> args;
+        while (pos < c.in.size()) {
+            size_t at = pos;
+            long long n = resp_num(c.in, at, '*');
+            if (n < 0) return false;
+            if (n == 0) break;
+            n--;
+            if (n == 0 || (size_t)n > RESP_MAX_ARGS) return false;
+
+            args.clear();
+            bool whole = true;
+            for (long long i = 0; i < n; ++i) {
+                long long len = resp_num(c.in, at, '$');
+                if (len < 0) return false;
+                if (len == 0) { whole = false; break; }
+                len--;
+                if ((size_t)len > MAX_LINE) return false;
+                if (c.in.size() - at < (size_t)len + 2) { whole = false; break; }
+                args.emplace_back(c.in, at, len);
+                at += len + 2;
+            }
+            if (!whole) break;
+
+            handle_resp(args, c.out, lsn);
+            pos = at;
+        }
+        c.in.erase(0, pos);
+        return c.in.size() <= MAX_LINE;
+    }
+
+    // every full line is a request
+    bool parse_text(Conn& c, uint64_t& lsn) {
+        size_t start = 0, nl;
+        while ((nl = c.in.find('\n', start)) != std::string::npos) {
+            size_t end = nl;
+            if (end > start && c.in[end - 1] == '\r') end--;
+            handle_line(c.in.substr(start, end - start), c.out, lsn);
+            start = nl + 1;
+        }
+        c.in.erase(0, start);
+        return c.in.size() <= MAX_LINE;
+    }
+
+    // send as much as the socket takes, false = connection is dead
+    bool flush_out(Conn& c) {
+        while (c.out_off < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.out_off,
+                             c.out.size() - c.out_off, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return true; // wait for EPOLLOUT
+                return false;
+            }
+            c.out_off += n;
+        }
+        c.out.clear();
+        c.out_off = 0;
+        return true;
+    }
+
+    // edge triggered, so read until the socket is empty. requests that
+    // came in with the FIN still get run and answered
+    bool on_readable(Conn& c) {
+        char buffer[16384];
+        while (!c.eof) {
+            ssize_t n = read(c.fd, buffer, sizeof(buffer));
+            if (n == 0) {
+                c.eof = true;
+                break;
+            }
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                return false;
+            }
+            c.in.append(buffer, n);
+        }
+
+        if (c.mode == UNKNOWN && !c.in.empty()) {
+            if ((unsigned char)c.in[0] == BIN_MAGIC) c.mode = BINARY;
+            else if (c.in[0] == '*') c.mode = RESP;
+            else c.mode = TEXT;
+        }
+        // a last line without its '\n' is still a request
+        if (c.eof && c.mode == TEXT && !c.in.empty() && c.in.back() != '\n') c.in += '\n';
+        // everything that came in is one batch: run it all, and if it
+        // wrote anything its replies wait (in one piece) for the journal
+        // to have its lsn, then go out in one send
+        uint64_t lsn = 0;
+        size_t from = c.out.size();
+        bool ok;
+        if (c.mode == BINARY) ok = parse_bin(c, lsn);
+        else if (c.mode == RESP) ok = parse_resp(c, lsn);
+        else ok = parse_text(c, lsn);
+        if (!ok) return false;
+
+        if ((lsn > dur_lsn || !c.held.empty()) && c.out.size() > from) {
+            c.held.emplace_back(lsn, c.out.substr(from));
+            c.out.resize(from);
+            want_sync(lsn);
+        }
+        release(c, dur_lsn);
+        return flush_out(c);
+    }
+
+    void run_loop(size_t li) {
+        int lfd = listeners[li];
+        int efd = wakers[li];
+        int ep = epoll_create1(0);
+        if (ep < 0) {
+            perror("epoll_create1 failed");
+            exit(EXIT_FAILURE);
+        }
+
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = lfd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+        ev.data.fd = efd;
+        epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev);
+
+        std::unordered_map<int, Conn> conns;
+        std::vector<int> parked; // conns with held replies
+        std::vector<epoll_event> events(256);
+
+        auto drop = [&](int fd) {
+            epoll_ctl(ep, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+            conns.erase(fd);
+        };
+
         while (running) {
-            int new_socket;
-            sockaddr_in address;
-            int addrlen = sizeof(address);
-
-            // accept new guy
-            if ((new_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen)) < 0) {
-                perror("Accept failed");
-                continue;
+            int n = epoll_wait(ep, events.data(), events.size(), -1);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait failed");
+                break;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+
+                if (fd == efd) {
+                    // durLsn moved, send whatever was waiting on it
+                    uint64_t cnt;
+                    while (read(efd, &cnt, sizeof(cnt)) > 0) {}
+                    uint64_t dur = dur_lsn;
+                    std::vector<int> still;
+                    for (int pfd : parked) {
+                        auto pit = conns.find(pfd);
+                        if (pit == conns.end()) continue;
+                        Conn& c = pit->second;
+                        release(c, dur);
+                        if (!flush_out(c) || (c.eof && c.out.empty() && c.held.empty())) drop(pfd);
+                        else if (!c.held.empty()) still.push_back(pfd);
+                    }
+                    parked.swap(still);
+                    continue;
+                }
+
+                if (fd == lfd) {
+                    // accept everyone who's waiting
+                    while (true) {
+                        int cfd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                        if (cfd < 0) {
+                            if (errno == EINTR) continue;
+                            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Accept failed");
+                            break;
+                        }
+                        int one = 1;
+                        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+                        epoll_event cev;
+                        memset(&cev, 0, sizeof(cev));
+                        cev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                        cev.data.fd = cfd;
+                        if (epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &cev) < 0) {
+                            close(cfd);
+                            continue;
+                        }
+                        conns[cfd] = Conn{cfd, UNKNOWN, std::string(), std::string(), 0, false, {}};
+                    }
+                    continue;
+                }
+
+                auto it = conns.find(fd);
+                if (it == conns.end()) continue;
+                Conn& c = it->second;
+                uint32_t e = events[i].events;
+
+                bool ok = !(e & EPOLLERR);
+                if (ok && (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                    bool was = !c.held.empty();
+                    ok = on_readable(c);
+                    if (ok && !was && !c.held.empty()) parked.push_back(fd);
+                }
+                if (ok && (e & EPOLLOUT)) ok = flush_out(c);
+                if (ok && c.eof && c.out.empty() && c.held.empty()) ok = false; // all answered
+                if (!ok) drop(fd);
+            }
+        }
+
+        for (auto& kv : conns) close(kv.first);
+        close(ep);
+    }
+
+public:
+    DBServer(SEng& engine, int port, int loops = 0) : db(engine), port(port), running(true) {
+        if (loops <= 0) loops = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < loops; ++i) {
+            listeners.push_back(make_listener());
+            int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (efd < 0) {
+                perror("eventfd failed");
+                exit(EXIT_FAILURE);
             }
+            wakers.push_back(efd);
+        }
+
+        std::cout << "Server listening on port " << port << " ("
+                  << loops << " event loops)..." << std::endl;
+    }
 
-            // spin up a thread
-            // let it run loose
-            std::thread client_thread(&DBServer::handle_client, this, new_socket);
-            client_thread.detach(); 
+    ~DBServer() {
+        for (int fd : listeners) close(fd);
+        for (int fd : wakers) close(fd);
+    }
+
+    // one thread per loop plus the syncer, returns when they all stop
+    void start() {
+        std::thread st(&DBServer::syncer, this);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < listeners.size(); ++i) {
+            threads.emplace_back(&DBServer::run_loop, this, i);
         }
+        for (auto& t : threads) t.join();
+        st.join();
     }
 };
 
 // main driver
-int main() {
+// usage: ./db [--port N] [--cache-mb N] [--page-kb N] [--data F]
+//             [--index F] [--journal F] [--no-fsync] [--huge-pages]
+//             [--flush-ms N] [--vacuum-s N] [--vacuum-rate N] [--loops N]
+//             [--ckpt-mb N]
+int main(int argc, char** argv) {
+    Opts opts;
+    int port = 8080;
+    int loops = 0; // 0 = one per core
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_val = i + 1 < argc;
+
+        if (arg == "--no-fsync") opts.fsync = false;
+        else if (arg == "--huge-pages") opts.huge = true;
+        else if (arg == "--port" && has_val) port = std::atoi(argv[++i]);
+        else if (arg == "--loops" && has_val) loops = std::atoi(argv[++i]);
+        else if (arg == "--cache-mb" && has_val) opts.cacheB = std::strtoull(argv[++i], nullptr, 10) << 20;
+        else if (arg == "--page-kb" && has_val) opts.pgSz = std::strtoull(argv[++i], nullptr, 10) << 10;
+        else if (arg == "--data" && has_val) opts.dFile = argv[++i];
+        else if (arg == "--index" && has_val) opts.iFile = argv[++i];
+        else if (arg == "--journal" && has_val) opts.jFile = argv[++i];
+        else if (arg == "--flush-ms" && has_val) opts.flushMs = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--vacuum-s" && has_val) opts.vacS = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--vacuum-rate" && has_val) opts.vacRate = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--ckpt-mb" && has_val) opts.ckptB = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10)) << 20;
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return 1;
+        }
+    }
+
     std::cout << "Initializing Database Engine..." << std::endl;
-    SEng engine; // fire up the engine
+    SEng engine(opts); // fire up the engine
     
     // stats checks
     engine.stats();
 
-    DBServer server(engine, 8080);
+    DBServer server(engine, port, loops);
     server.start();
 
     return 0;
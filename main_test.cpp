@@ -10,10 +10,229 @@
 #include <sstream>
 #include <iomanip>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <csignal>
+#include <unistd.h>
+#include <random>
+#include <set>
 
 //yeah am lazzzeee
 using namespace std;
 
+// the cache we used to have, for PART 5: a map by pid plus a timestamp,
+// a miss at capacity walks the whole map for the oldest one
+struct OldPool {
+	struct CEnt {
+		shared_ptr<Pg> pg;
+		size_t tm;
+	};
+	map<uint64_t, CEnt> cache;
+	size_t curTm = 0;
+	size_t cap;
+
+	OldPool(size_t c) : cap(c) {}
+
+	shared_ptr<Pg> fetch(uint64_t pid, bool* hit) {
+		auto it = cache.find(pid);
+		if (it != cache.end()) {
+			it->second.tm = ++curTm;
+			*hit = true;
+			return it->second.pg;
+		}
+		*hit = false;
+		if (cache.size() >= cap) {
+			auto old = cache.begin();
+			for (auto e = cache.begin(); e != cache.end(); ++e) {
+				if (e->second.tm < old->second.tm) old = e;
+			}
+			cache.erase(old);
+		}
+		auto pg = make_shared<Pg>(pid, 1024);
+		cache[pid] = {pg, ++curTm};
+		return pg;
+	}
+};
+
+// the later parts each get their own files, so they start from nothing
+// and leave the demo's database alone
+static Opts tOpts(const string& name) {
+	Opts o;
+	o.dFile = name + ".dat";
+	o.iFile = name + ".idx";
+	o.jFile = name + ".log";
+	o.vacS = 0; // vacuum only when we call it
+	return o;
+}
+
+static void tClean(const string& name) {
+	for (const char* ext : {".dat", ".idx", ".idx.tmp", ".log"}) {
+		remove((name + ext).c_str());
+	}
+}
+
+static size_t fileSize(const string& fn) {
+	struct stat st;
+	return stat(fn.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// a random mix of puts and deletes over a few thousand keys, mirrored
+// into m. db = nullptr just works out what m should end up as
+static void churn(SEng* db, map<string, string>& m, unsigned seed, int n) {
+	mt19937 r(seed);
+	for (int i = 0; i < n; ++i) {
+		string k = "crash:" + to_string(r() % 3000);
+		if (r() % 4 == 0) {
+			if (db) db->remove(k);
+			m.erase(k);
+			continue;
+		}
+		string v = to_string(i) + string(r() % 150, 'x');
+		if (db) {
+			if (m.count(k)) db->update(k, v);
+			else db->insert(k, v);
+		}
+		m[k] = v;
+	}
+}
+
+// keys that don't read back the way m says they should
+static int mismatches(SEng& db, const map<string, string>& m) {
+	int bad = 0;
+	for (int i = 0; i < 3000; ++i) {
+		string k = "crash:" + to_string(i);
+		auto r = db.get(k);
+		auto it = m.find(k);
+		if (r.first != (it != m.end()) || (r.first && r.second != it->second)) bad++;
+	}
+	return bad;
+}
+
+// run fn on a fresh engine in a child that then dies without closing it:
+// no checkpoint, no page writes, just whatever already made it to disk
+template<typename F>
+static void crashAfter(const Opts& o, F fn) {
+	cout << flush;
+	pid_t p = fork();
+	if (p == 0) {
+		SEng db(o);
+		fn(db);
+		_exit(0);
+	}
+	waitpid(p, nullptr, 0);
+}
+
+// every other key or so out of scan:00000..scan:05999, mirrored into m.
+// thousands of keys, so walks cross lots of leaves and cursor refills
+static void scanData(SEng& db, map<string, string>& m) {
+	mt19937 r(11);
+	for (int i = 0; i < 6000; ++i) {
+		if (r() % 2) continue;
+		char k[16];
+		snprintf(k, sizeof(k), "scan:%05d", i);
+		string v = to_string(i) + string(r() % 100, 's');
+		db.insert(k, v);
+		m[k] = v;
+	}
+}
+
+// what scan(a, b, limit) should give going up, straight from the model
+static vector<pair<string, string>> modelScan(const map<string, string>& m, const string& a,
+											  const string& b, size_t limit) {
+	vector<pair<string, string>> out;
+	for (auto it = m.lower_bound(a); it != m.end() && (b.empty() || it->first < b) && out.size() < limit; ++it) {
+		out.push_back(*it);
+	}
+	return out;
+}
+
+// same going down: keys in [a, b) from the top, or only those <= upTo
+// when it's given (what seekForPrev(upTo) then prev() should give)
+static vector<pair<string, string>> modelRev(const map<string, string>& m, const string& a,
+											 const string& b, size_t limit, const string* upTo = nullptr) {
+	vector<pair<string, string>> out;
+	auto it = b.empty() ? m.end() : m.lower_bound(b);
+	if (upTo && (b.empty() || *upTo < b)) it = m.upper_bound(*upTo);
+	while (it != m.begin() && out.size() < limit) {
+		--it;
+		if (it->first < a) break;
+		out.push_back(*it);
+	}
+	return out;
+}
+
+// just enough of a redis client for PART 11: send a command, read one
+// reply back with nested arrays flattened into out
+struct RespCli {
+	int fd = -1;
+	string buf;
+	
+	// the server is starting up in another process, give it a moment
+	bool open(int port) {
+		for (int tries = 0; tries < 200; ++tries) {
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+			sockaddr_in a{};
+			a.sin_family = AF_INET;
+			a.sin_port = htons(port);
+			a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			if (connect(fd, (sockaddr*)&a, sizeof(a)) == 0) return true;
+			close(fd);
+			usleep(20000);
+		}
+		fd = -1;
+		return false;
+	}
+	
+	~RespCli() { if (fd >= 0) close(fd); }
+	
+	bool fill(size_t n) {
+		char tmp[65536];
+		while (buf.size() < n) {
+			ssize_t got = read(fd, tmp, sizeof(tmp));
+			if (got <= 0) return false;
+			buf.append(tmp, got);
+		}
+		return true;
+	}
+	
+	bool line(string& l) {
+		size_t eol;
+		while ((eol = buf.find("\r\n")) == string::npos) {
+			if (!fill(buf.size() + 1)) return false;
+		}
+		l = buf.substr(0, eol);
+		buf.erase(0, eol + 2);
+		return true;
+	}
+	
+	bool reply(vector<string>& out) {
+		string l;
+		if (!line(l) || l.empty()) return false;
+		long long n = atoll(l.c_str() + 1);
+		if (l[0] == '*') {
+			for (long long i = 0; i < n; ++i) {
+				if (!reply(out)) return false;
+			}
+		} else if (l[0] == '$' && n >= 0) {
+			if (!fill(n + 2)) return false;
+			out.push_back(buf.substr(0, n));
+			buf.erase(0, n + 2);
+		} else {
+			out.push_back(l); // +OK, -ERR, :1, $-1
+		}
+		return true;
+	}
+	
+	bool call(const vector<string>& args, vector<string>& out) {
+		string req = "*" + to_string(args.size()) + "\r\n";
+		for (const auto& a : args) req += "$" + to_string(a.size()) + "\r\n" + a + "\r\n";
+		if (write(fd, req.data(), req.size()) != (ssize_t)req.size()) return false;
+		out.clear();
+		return reply(out);
+	}
+};
+
 int main(){
 	cout << "╔══════════════════════════════════════════════════════╗\n";
 	cout << "║     MINI DATABASE ENGINE - C++ Implementation        ║\n";
@@ -55,7 +274,12 @@ int main(){
 	db.remove("product:5002");
 	auto res5 = db.get("product:5002");
 	cout << "  -> Verify delete: " << (res5.first ? "FAILED, STILL THERE" : "OK, gone.") << "\n";
-	
+
+	// too long for a record, has to be turned away (not cut short)
+	cout << "\nInserting a 300 byte key...\n";
+	bool longIn = db.insert(string(300, 'k'), "too long");
+	cout << "  -> " << (longIn ? "FAILED, ACCEPTED IT" : "OK, rejected.") << "\n";
+
 
 	// --- Bulk Insert Test ---
 	cout << "\n\n► PART 2: Bulk Insert (Stress Test)\n";
@@ -149,6 +373,552 @@ int main(){
 	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
 	db.stats(); // call the stats func
 	
+	
+	// --- Buffer pool microbenchmark ---
+	cout << "\n\n► PART 5: Buffer Pool Microbenchmark\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	cout << "\n(random pids over 2x the pool size, so about half are misses,";
+	cout << "\n old = the map + linear scan evict() we had before)\n";
+	
+	// no disk behind it, we only care about the bookkeeping
+	const size_t OPS = 2000000;
+	
+	for (size_t frames : {100, 1000, 10000, 100000, 1000000}) {
+		double ns, oldNs;
+		size_t hits = 0;
+		{
+			BPool pool(frames, 1024);
+			for (size_t pid = 1; pid <= frames; ++pid) pool.fetch(pid);
+			
+			mt19937_64 rng(42);
+			auto b1 = chrono::high_resolution_clock::now();
+			for (size_t i = 0; i < OPS; ++i) {
+				uint64_t pid = 1 + rng() % (2 * frames);
+				bool hit;
+				pool.fetch(pid, &hit); // pin + unpin, miss -> evicts at capacity
+				if (hit) hits++;
+			}
+			auto b2 = chrono::high_resolution_clock::now();
+			ns = chrono::duration_cast<chrono::nanoseconds>(b2 - b1).count() / (double)OPS;
+		}
+		{
+			// every miss is O(frames) here, so fewer ops or we'd be here all day
+			size_t oldOps = max<size_t>(200, min<size_t>(OPS, 40000000 / frames));
+			OldPool pool(frames);
+			bool hit;
+			for (size_t pid = 1; pid <= frames; ++pid) pool.fetch(pid, &hit);
+			
+			mt19937_64 rng(42);
+			auto b1 = chrono::high_resolution_clock::now();
+			for (size_t i = 0; i < oldOps; ++i) pool.fetch(1 + rng() % (2 * frames), &hit);
+			auto b2 = chrono::high_resolution_clock::now();
+			oldNs = chrono::duration_cast<chrono::nanoseconds>(b2 - b1).count() / (double)oldOps;
+		}
+		
+		cout << "  " << setw(8) << frames << " frames: " << fixed << setprecision(1)
+			 << ns << " ns/op (old " << oldNs << " ns/op, " << setprecision(0)
+			 << oldNs / ns << "x), hit rate " << setprecision(1) << (100.0 * hits / OPS) << "%\n";
+	}
+	
+	
+	// --- In-node search microbenchmark ---
+	cout << "\n\n► PART 6: Index Search Microbenchmark (SIMD vs Scalar)\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	cout << "\n(random point lookups, tree small enough to stay in cache)\n";
+	
+	const size_t T_KEYS = 20000, LOOKUPS = 2000000;
+	BTree tree;
+	vector<string> tkeys;
+	mt19937_64 trng(7);
+	for (size_t i = 0; i < T_KEYS; ++i) {
+		tkeys.push_back("bench:" + to_string(trng() % 100000000));
+		tree.insert(tkeys.back(), i + 1);
+	}
+	vector<size_t> order(LOOKUPS);
+	for (auto& o : order) o = trng() % T_KEYS;
+	
+	const int best = simdLvl;
+	const char* names[] = {"scalar", "SSE4.2", "AVX2"};
+	double base = 0;
+	for (int lvl : {0, best}) {
+		simdLvl = lvl;
+		size_t found = 0;
+		auto s1 = chrono::high_resolution_clock::now();
+		for (size_t o : order) if (tree.search(tkeys[o])) found++;
+		auto s2 = chrono::high_resolution_clock::now();
+		
+		double ns = chrono::duration_cast<chrono::nanoseconds>(s2 - s1).count() / (double)LOOKUPS;
+		if (lvl == 0) base = ns;
+		cout << "  " << setw(8) << names[lvl] << ": " << fixed << setprecision(1)
+			 << ns << " ns/lookup, " << found << " found";
+		if (lvl != 0) cout << ", " << setprecision(2) << base / ns << "x";
+		cout << "\n";
+		if (best == 0) break; // no SIMD on this cpu
+	}
+	simdLvl = best;
+	
+	
+	// --- Vacuum ---
+	cout << "\n\n► PART 7: Vacuum\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	const int V_N = 20000;
+	tClean("vac");
+	Opts vo = tOpts("vac");
+	vo.vacRate = 0; // no pacing, as fast as it goes
+	{
+		SEng v(vo);
+		cout << "\nInserting " << V_N << " records, then deleting 9 out of 10...\n";
+		for (int i = 0; i < V_N; ++i) v.insert("vac:" + to_string(i), string(100, 'v') + to_string(i));
+		for (int i = 0; i < V_N; ++i) if (i % 10 != 0) v.remove("vac:" + to_string(i));
+		v.flushAll();
+		size_t before = fileSize(vo.dFile);
+		
+		size_t emptied = v.vacuum();
+		v.flushAll();
+		size_t after = fileSize(vo.dFile);
+		cout << "  -> Emptied " << emptied << " pages, file " << before << " -> " << after << " bytes\n";
+		cout << "  -> File shrank: " << (after < before ? "OK" : "FAILED") << "\n";
+		
+		int good = 0;
+		for (int i = 0; i < V_N; i += 10) {
+			auto r = v.get("vac:" + to_string(i));
+			if (r.first && r.second == string(100, 'v') + to_string(i)) good++;
+		}
+		cout << "  -> Survivors intact: " << good << "/" << V_N / 10 << "\n";
+	}
+	{
+		// and it all has to come back the same after a restart
+		SEng v(vo);
+		int good = 0, ghosts = 0;
+		for (int i = 0; i < V_N; ++i) {
+			auto r = v.get("vac:" + to_string(i));
+			if (i % 10 != 0) ghosts += r.first;
+			else if (r.first && r.second == string(100, 'v') + to_string(i)) good++;
+		}
+		cout << "  -> After reopen: " << good << "/" << V_N / 10 << " intact, "
+			 << ghosts << " deleted keys back " << (good == V_N / 10 && ghosts == 0 ? "(OK)" : "(FAILED)") << "\n";
+	}
+	tClean("vac");
+	
+	// --- Index delete ---
+	cout << "\n\n► PART 8: Index Delete (merge + shrink)\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		// random deletes against a std::map that knows the answer
+		const size_t D_KEYS = 50000;
+		BTree dt;
+		map<string, uint64_t> model;
+		mt19937_64 drng(11);
+		for (size_t i = 0; i < D_KEYS; ++i) {
+			string k = "del:" + to_string(drng() % 1000000000);
+			dt.insert(k, i + 1);
+			model[k] = i + 1;
+		}
+		vector<string> dkeys;
+		for (auto& kv : model) dkeys.push_back(kv.first);
+		size_t fullDepth = dt.depth();
+		shuffle(dkeys.begin(), dkeys.end(), drng);
+		
+		cout << "\n" << model.size() << " keys, depth " << fullDepth << ". Deleting all but 100 in random order...\n";
+		auto check = [&]() {
+			auto all = dt.getAllKeys();
+			bool same = all.size() == model.size();
+			size_t i = 0;
+			for (auto& kv : model) {
+				if (!same) break;
+				same = all[i++] == kv.first && dt.search(kv.first) == kv.second;
+			}
+			return same;
+		};
+		
+		bool ok = true;
+		size_t keep = 100;
+		for (size_t i = 0; i + keep < dkeys.size(); ++i) {
+			dt.remove(dkeys[i]);
+			model.erase(dkeys[i]);
+			if (i % 5000 == 0) ok = ok && check(); // every so often, it's O(n)
+		}
+		ok = ok && check();
+		int gone = 0;
+		for (size_t i = 0; i + keep < dkeys.size(); ++i) gone += dt.search(dkeys[i]) == 0;
+		cout << "  -> Tree matches the model: " << (ok ? "OK" : "FAILED") << "\n";
+		cout << "  -> Deleted keys gone: " << (gone == (int)(dkeys.size() - keep) ? "OK" : "FAILED") << "\n";
+		cout << "  -> Depth " << fullDepth << " -> " << dt.depth() << (dt.depth() < fullDepth ? " (OK)" : " (FAILED)") << "\n";
+		
+		for (size_t i = dkeys.size() - keep; i < dkeys.size(); ++i) {
+			dt.remove(dkeys[i]);
+			model.erase(dkeys[i]);
+		}
+		dt.insert("del:again", 7);
+		model["del:again"] = 7;
+		cout << "  -> Emptied and reused: " << (dt.depth() == 1 && check() ? "OK" : "FAILED") << "\n";
+	}
+	
+	
+	// --- Free page reuse ---
+	cout << "\n\n► PART 9: Free Page Reuse (insert/delete churn)\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		// every round writes a new batch of keys and deletes the last one,
+		// the emptied pages should take the new batch. without reuse the
+		// file would grow by a batch a round, give or take a page is fine
+		const int ROUNDS = 10, PER = 5000;
+		tClean("churn");
+		Opts co = tOpts("churn");
+		size_t first = 0, last = 0;
+		{
+			SEng c(co);
+			cout << "\n" << ROUNDS << " rounds of " << PER << " inserts + deletes...\n";
+			for (int r = 0; r < ROUNDS; ++r) {
+				for (int i = 0; i < PER; ++i) c.insert("churn:" + to_string(r) + ":" + to_string(i), string(80, 'c'));
+				if (r > 0) for (int i = 0; i < PER; ++i) c.remove("churn:" + to_string(r - 1) + ":" + to_string(i));
+				c.flushAll();
+				if (r == 1) first = fileSize(co.dFile);
+			}
+			last = fileSize(co.dFile);
+		}
+		cout << "  -> File after round 2: " << first << " bytes, after round " << ROUNDS << ": " << last << " bytes "
+			 << (last <= first * 11 / 10 ? "(OK)" : "(FAILED)") << "\n";
+		
+		{
+			// the free list comes back from index.dat, so this round can't grow it either
+			SEng c(co);
+			for (int i = 0; i < PER; ++i) c.remove("churn:" + to_string(ROUNDS - 1) + ":" + to_string(i));
+			for (int i = 0; i < PER; ++i) c.insert("churn:x:" + to_string(i), string(80, 'c'));
+			c.flushAll();
+			int good = 0;
+			for (int i = 0; i < PER; ++i) good += c.get("churn:x:" + to_string(i)).first;
+			cout << "  -> After reopen: " << fileSize(co.dFile) << " bytes, " << good << "/" << PER << " found "
+				 << (fileSize(co.dFile) <= last * 11 / 10 && good == PER ? "(OK)" : "(FAILED)") << "\n";
+		}
+		tClean("churn");
+	}
+	
+	
+	// --- Crash recovery ---
+	cout << "\n\n► PART 10: Crash Recovery\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		tClean("crash");
+		Opts ko = tOpts("crash");
+		ko.vacRate = 0;
+		map<string, string> km;
+		
+		cout << "\nChurn, then kill it before any checkpoint...\n";
+		crashAfter(ko, [](SEng& c) {
+			map<string, string> m;
+			churn(&c, m, 1, 20000);
+		});
+		churn(nullptr, km, 1, 20000);
+		{
+			SEng c(ko);
+			int bad = mismatches(c, km);
+			cout << "  -> " << bad << " keys wrong " << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		}
+		
+		// checkpoint, delete most of it, vacuum the holes, write some
+		// more and die. records moved by the vacuum have to come back
+		// where the index says they are
+		cout << "\nChurn, checkpoint, delete, vacuum, churn, then kill it...\n";
+		crashAfter(ko, [km](SEng& c) {
+			map<string, string> m = km; // what the first round left behind
+			churn(&c, m, 2, 20000);
+			c.flushAll();
+			for (int i = 0; i < 3000; ++i) {
+				if (i % 8 == 0) continue;
+				c.remove("crash:" + to_string(i));
+				m.erase("crash:" + to_string(i));
+			}
+			c.vacuum();
+			churn(&c, m, 3, 2000);
+		});
+		churn(nullptr, km, 2, 20000);
+		for (int i = 0; i < 3000; ++i) if (i % 8 != 0) km.erase("crash:" + to_string(i));
+		churn(nullptr, km, 3, 2000);
+		{
+			SEng c(ko);
+			int bad = mismatches(c, km);
+			cout << "  -> " << bad << " keys wrong " << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		}
+		
+		// a small ckptB has the flusher cut the journal back as it goes
+		cout << "\nChurn with checkpoints every 64 KB of journal, then kill it...\n";
+		Opts kc = ko;
+		kc.ckptB = 64 << 10;
+		crashAfter(kc, [km](SEng& c) {
+			map<string, string> m = km;
+			churn(&c, m, 4, 20000);
+		});
+		churn(nullptr, km, 4, 20000);
+		size_t jSz = fileSize(kc.jFile);
+		{
+			SEng c(kc);
+			int bad = mismatches(c, km);
+			cout << "  -> Journal was " << jSz << " bytes " << (jSz < 4 * kc.ckptB ? "(OK)" : "(FAILED)") << "\n";
+			cout << "  -> " << bad << " keys wrong " << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		}
+		tClean("crash");
+	}
+	
+	
+	// --- SCAN over RESP ---
+	cout << "\n\n► PART 11: RESP SCAN Walk\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		// the server never returns, so it runs in a child that gets killed
+		tClean("resp");
+		Opts ro = tOpts("resp");
+		ro.fsync = false;
+		int port = 20000 + getpid() % 20000;
+		cout << flush;
+		pid_t srv = fork();
+		if (srv == 0) {
+			SEng s(ro);
+			DBServer server(s, port, 2);
+			server.start();
+			_exit(0);
+		}
+		
+		RespCli cli;
+		set<string> keys;
+		vector<string> r;
+		bool up = cli.open(port);
+		for (int b = 0; up && b < 30; ++b) {
+			vector<string> cmd = {"MSET"};
+			for (int i = 0; i < 100; ++i) {
+				string k = "resp:" + to_string(b * 100 + i);
+				cmd.push_back(k);
+				cmd.push_back("v");
+				keys.insert(k);
+			}
+			up = cli.call(cmd, r);
+		}
+		
+		// walk it the way redis-cli does: the cursor is a decimal number
+		set<string> seen;
+		int dups = 0, calls = 0;
+		bool numeric = true;
+		string cur = "0";
+		do {
+			if (!up || !cli.call({"SCAN", cur, "COUNT", "37"}, r) || r.empty()) {
+				up = false;
+				break;
+			}
+			char* end;
+			unsigned long long c = strtoull(r[0].c_str(), &end, 10);
+			if (r[0].empty() || *end != '\0') numeric = false;
+			cur = to_string(c);
+			for (size_t i = 1; i < r.size(); ++i) {
+				if (!seen.insert(r[i]).second) dups++;
+			}
+			calls++;
+		} while (cur != "0" && calls < 1000);
+		bool ok = up && numeric && dups == 0 && seen == keys;
+		cout << "Walked " << seen.size() << " of " << keys.size() << " keys in " << calls
+			 << " calls, " << dups << " seen twice " << (ok ? "(OK)" : "(FAILED)") << "\n";
+		
+		bool rej = up && cli.call({"SCAN", "987654321"}, r) && r.size() == 1 && r[0] == "-ERR invalid cursor";
+		cout << "Unknown cursor turned away " << (rej ? "(OK)" : "(FAILED)") << "\n";
+		
+		kill(srv, SIGKILL);
+		waitpid(srv, nullptr, 0);
+		tClean("resp");
+	}
+	
+	
+	// --- Range scans ---
+	cout << "\n\n► PART 12: Range Scan\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		tClean("scan");
+		SEng sd(tOpts("scan"));
+		map<string, string> sm;
+		scanData(sd, sm);
+		
+		auto walk = [](SEng::Cursor c) {
+			vector<pair<string, string>> out;
+			string k, v;
+			while (c.next(k, v)) out.emplace_back(k, v);
+			return out;
+		};
+		
+		// ends that are keys and ends that fall between keys, open ends,
+		// limits that run out mid range, past the end and at zero
+		struct Case { string a, b; size_t limit; };
+		vector<Case> cases = {
+			{"", "", SIZE_MAX},
+			{"scan:01000", "scan:04000", SIZE_MAX},
+			{"scan:01000x", "scan:04000x", SIZE_MAX},
+			{"scan:02500", "", SIZE_MAX},
+			{"", "scan:00700", SIZE_MAX},
+			{"scan:00100", "scan:05900", 333},
+			{"scan:05990", "", 100},
+			{"scan:03000", "scan:03000", SIZE_MAX},
+			{"scan:03000", "", 0},
+			{"zzz", "", SIZE_MAX},
+		};
+		int bad = 0;
+		size_t rows = 0;
+		for (const auto& c : cases) {
+			auto got = walk(sd.scan(c.a, c.b, c.limit));
+			rows += got.size();
+			if (got != modelScan(sm, c.a, c.b, c.limit)) bad++;
+		}
+		cout << cases.size() << " ranges, " << rows << " rows, " << bad << " wrong "
+			 << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		
+		// change things ahead of a cursor that's half way through its
+		// buffer: deleted keys get skipped, moved ones still turn up
+		auto c = sd.scan("scan:00500", "", SIZE_MAX);
+		vector<pair<string, string>> got;
+		string k, v;
+		for (int i = 0; i < 10 && c.next(k, v); ++i) got.emplace_back(k, v);
+		auto it = sm.upper_bound(got.back().first);
+		for (int i = 0; i < 40 && it != sm.end(); ++i) {
+			if (i % 2 == 0) {
+				sd.remove(it->first);
+				it = sm.erase(it);
+			} else {
+				it->second = string(900, 'm'); // won't fit where it was
+				sd.update(it->first, it->second);
+				++it;
+			}
+		}
+		while (c.next(k, v)) got.emplace_back(k, v);
+		bool ok = got == modelScan(sm, "scan:00500", "", SIZE_MAX);
+		cout << "Deletes and moves ahead of a cursor " << (ok ? "(OK)" : "(FAILED)") << "\n";
+	}
+	tClean("scan");
+	
+	
+	// --- Walking backwards ---
+	cout << "\n\n► PART 13: Reverse Scan\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		tClean("rscan");
+		SEng rd(tOpts("rscan"));
+		map<string, string> rm;
+		scanData(rd, rm);
+		
+		auto back = [](SEng::Cursor c) {
+			vector<pair<string, string>> out;
+			string k, v;
+			while (c.prev(k, v)) out.emplace_back(k, v);
+			return out;
+		};
+		
+		// prev() from the top of [lo, hi), closed and open at the top
+		struct Case { string a, b; size_t limit; };
+		vector<Case> cases = {
+			{"", "", SIZE_MAX},
+			{"scan:01000", "scan:04000", SIZE_MAX},
+			{"scan:01000x", "scan:04000x", SIZE_MAX},
+			{"scan:02500", "", SIZE_MAX},
+			{"scan:00100", "scan:05900", 333},
+			{"scan:03000", "scan:03000", SIZE_MAX},
+		};
+		int bad = 0;
+		for (const auto& c : cases) {
+			if (back(rd.scan(c.a, c.b, c.limit)) != modelRev(rm, c.a, c.b, c.limit)) bad++;
+		}
+		cout << "prev() over " << cases.size() << " ranges, " << bad << " wrong "
+			 << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		
+		// seekForPrev(k) starts at the last key <= k, and never at or
+		// past hi: on a key, between keys, past hi, below lo
+		vector<string> seeks = {"scan:03000", "scan:03001", "scan:03000x", "scan:04000", "scan:09999", "scan:00001"};
+		bad = 0;
+		for (const auto& k : seeks) {
+			for (const string& hi : {string("scan:04000"), string()}) {
+				auto c = rd.scan("scan:01000", hi, 500);
+				c.seekForPrev(k);
+				if (back(c) != modelRev(rm, "scan:01000", hi, 500, &k)) bad++;
+			}
+		}
+		cout << "seekForPrev() from " << seeks.size() * 2 << " places, " << bad << " wrong "
+			 << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		
+		// turning around carries on from the last key handed out
+		auto up = modelScan(rm, "scan:02000", "", 3);
+		auto c = rd.scan("scan:02000", "", SIZE_MAX);
+		string k, v;
+		vector<string> got;
+		for (int i = 0; i < 3; ++i) got.push_back(c.next(k, v) ? k : "");
+		got.push_back(c.prev(k, v) ? k : "");
+		bool ok = got == vector<string>{up[0].first, up[1].first, up[2].first, up[1].first};
+		auto down = modelRev(rm, "", "scan:02000", 3);
+		auto d = rd.scan("", "scan:02000", SIZE_MAX);
+		got.clear();
+		for (int i = 0; i < 3; ++i) got.push_back(d.prev(k, v) ? k : "");
+		got.push_back(d.next(k, v) ? k : "");
+		ok = ok && got == vector<string>{down[0].first, down[1].first, down[2].first, down[1].first};
+		cout << "next, next, next, prev (and the other way round) " << (ok ? "(OK)" : "(FAILED)") << "\n";
+	}
+	tClean("rscan");
+	
+	
+	// --- Batches ---
+	cout << "\n\n► PART 14: Batched Writes and Reads\n";
+	cout << "━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━\n";
+	
+	{
+		tClean("batch");
+		Opts bo = tOpts("batch");
+		map<string, string> bm;
+		mt19937 r(5);
+		int bad = 0, rejected = 0;
+		{
+			SEng bd(bo);
+			// runs of new keys fill leaves and split them, every key
+			// shows up a few times per batch (the last one wins), and some
+			// values grow too big for their page and move mid batch
+			for (int round = 0; round < 200; ++round) {
+				vector<pair<string, string>> kv;
+				int n = 1 + r() % 300;
+				for (int i = 0; i < n; ++i) {
+					string k = "batch:" + to_string(r() % 8000);
+					string v = to_string(round) + string(r() % (round % 3 == 0 ? 900 : 40), 'b');
+					kv.emplace_back(k, v);
+					if (i % 10 == 0) kv.emplace_back(k, v + "!");
+				}
+				if (!bd.writeBatch(kv)) rejected++;
+				for (const auto& p : kv) bm[p.first] = p.second;
+			}
+			
+			// multiGet answers in the caller's order, repeats and misses too
+			vector<string> ask;
+			for (int i = 0; i < 5000; ++i) ask.push_back("batch:" + to_string(r() % 9000));
+			auto res = bd.multiGet(ask);
+			for (size_t i = 0; i < ask.size(); ++i) {
+				auto it = bm.find(ask[i]);
+				if (res[i].first != (it != bm.end()) || (res[i].first && res[i].second != it->second)) bad++;
+			}
+		}
+		cout << "200 batches, " << bm.size() << " keys, " << rejected << " turned away, "
+			 << bad << " wrong from multiGet " << (rejected == 0 && bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+		
+		// and the same from disk after a reopen
+		SEng bd(bo);
+		vector<string> all;
+		for (const auto& p : bm) all.push_back(p.first);
+		reverse(all.begin(), all.end());
+		auto res = bd.multiGet(all);
+		bad = 0;
+		for (size_t i = 0; i < all.size(); ++i) {
+			if (!res[i].first || res[i].second != bm[all[i]]) bad++;
+		}
+		cout << "After a reopen: " << bad << " wrong " << (bad == 0 ? "(OK)" : "(FAILED)") << "\n";
+	}
+	tClean("batch");
+	
+	
 	cout << "\n╔══════════════════════════════════════════════════════╗\n";
 	cout << "║     Demo Complete! Database files saved to disk.     ║\n";
 	cout << "╚══════════════════════════════════════════════════════╝\n";